@@ -0,0 +1,129 @@
+// FlatMap against the std::unordered_map it replaced in the variable
+// tables: inserting every name, looking up names that exist and names that
+// don't, and scanning the whole table. run with `make bench`
+#define CALC_NO_MAIN
+#include "../main.cc"
+
+#include <random>
+#include <unordered_map>
+
+namespace {
+
+constexpr std::size_t kNames = 50'000;
+constexpr std::size_t kLookups = 1'000'000;
+constexpr std::size_t kScans = 100;
+constexpr int kRuns = 3;
+
+// a third of the names are too long to stay inside std::string
+std::vector<std::string> make_names(char const* const prefix) {
+    std::vector<std::string> out;
+    for (std::size_t i = 0; i < kNames; i++) {
+        out.push_back(i % 3 ? prefix + std::to_string(i)
+                            : "a_rather_long_variable_name_" + std::string(
+                                  prefix) + std::to_string(i));
+    }
+    return out;
+}
+
+template <typename Work>
+double median_ms(Work&& work) {
+    double runs[kRuns];
+    for (auto& run : runs) {
+        auto const start = std::chrono::steady_clock::now();
+        work();
+        run = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    }
+    std::sort(std::begin(runs), std::end(runs));
+    return runs[kRuns / 2];
+}
+
+// keeps results alive without the compiler seeing through them
+volatile double g_sink;
+
+struct Unordered {
+    std::unordered_map<std::string, Value> map;
+
+    void insert(std::string const& name) { map[name] = Value(1); }
+    Value const* find(std::string const& name) const {
+        auto const found = map.find(name);
+        return found == map.end() ? nullptr : &found->second;
+    }
+    template <typename Visit>
+    void for_each(Visit&& visit) const {
+        for (auto const& [name, value] : map)
+            visit(name, value);
+    }
+};
+
+struct Flat {
+    FlatMap<Value> map;
+
+    void insert(std::string const& name) { map[name] = Value(1); }
+    Value const* find(std::string const& name) const { return map.find(name); }
+    template <typename Visit>
+    void for_each(Visit&& visit) const {
+        map.for_each(visit);
+    }
+};
+
+template <typename Map>
+void bench(char const* const label,
+           std::vector<std::string> const& names,
+           std::vector<std::string> const& hits,
+           std::vector<std::string> const& misses) {
+    double const insert = median_ms([&] {
+        Map map;
+        for (auto const& name : names)
+            map.insert(name);
+        g_sink = map.find(names[0])->number();
+    });
+
+    Map map;
+    for (auto const& name : names)
+        map.insert(name);
+
+    auto lookups = [&](std::vector<std::string> const& keys) {
+        return median_ms([&] {
+            double sum = 0;
+            for (std::size_t i = 0; i < kLookups; i++) {
+                auto const* const found = map.find(keys[i % keys.size()]);
+                sum += found ? found->number() : 0;
+            }
+            g_sink = sum;
+        });
+    };
+    double const hit = lookups(hits);
+    double const miss = lookups(misses);
+
+    double const scan = median_ms([&] {
+        double sum = 0;
+        for (std::size_t i = 0; i < kScans; i++) {
+            map.for_each([&](std::string const&, Value const& value) {
+                sum += value.number();
+            });
+        }
+        g_sink = sum;
+    });
+
+    std::printf("%-14s %10.1f %10.1f %10.1f %10.1f\n", label, insert, hit,
+                miss, scan);
+}
+
+}  // namespace
+
+int main() {
+    auto const names = make_names("v");
+    auto const misses = make_names("w");
+    auto hits = names;
+    std::shuffle(hits.begin(), hits.end(), std::mt19937(42));
+
+    std::printf("%zu names, %zu lookups, %zu scans, median of %d runs in "
+                "ms\n",
+                kNames, kLookups, kScans, kRuns);
+    std::printf("%-14s %10s %10s %10s %10s\n", "", "insert", "hits",
+                "misses", "scans");
+    bench<Unordered>("unordered_map", names, hits, misses);
+    bench<Flat>("FlatMap", names, hits, misses);
+}
@@ -1,21 +1,584 @@
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <functional>
+#include <initializer_list>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// x86-64 builds carry avx2 and avx-512 clones of the hot kernels next to the
+// baseline ones and pick between them at startup
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define CALC_ISA_CLONES 1
+#include <immintrin.h>
+#endif
+
+// what the program is doing, for attributing allocations and counter
+// readings. set by PhaseScope, per thread; the thread pools start their
+// workers in the phase of the thread that started them
+enum class Phase : std::uint8_t {
+    Other,
+    Lex,
+    Parse,
+    Bind,
+    Execute,
+    Variables,
+};
+
+constexpr char const* kPhaseNames[] = {"other",   "lex",     "parse",
+                                       "bind",    "execute", "variables"};
+constexpr std::size_t kPhases = std::size(kPhaseNames);
+
+inline thread_local Phase g_phase = Phase::Other;
+
+// allocation counters behind the global operator new, off unless --mem asks
+// for them. live bytes are net since tracking began, measured as the
+// allocator's usable sizes so frees match their allocations
+struct MemoryStats {
+    std::atomic<bool> tracking{false};
+    std::atomic<std::uint64_t> allocs[kPhases] = {};
+    std::atomic<std::uint64_t> bytes[kPhases] = {};
+    std::atomic<std::int64_t> live{0};
+    std::atomic<std::int64_t> peak{0};
+
+    void allocated(void* const block, std::size_t const bytes_) noexcept {
+        auto const idx = std::size_t(g_phase);
+        allocs[idx].fetch_add(1, std::memory_order_relaxed);
+        bytes[idx].fetch_add(bytes_, std::memory_order_relaxed);
+
+        std::int64_t const now =
+            live.fetch_add(usable(block), std::memory_order_relaxed) +
+            usable(block);
+        std::int64_t high = peak.load(std::memory_order_relaxed);
+        while (now > high and
+               not peak.compare_exchange_weak(high, now,
+                                              std::memory_order_relaxed)) {
+        }
+    }
+
+    void released(void* const block) noexcept {
+        live.fetch_sub(usable(block), std::memory_order_relaxed);
+    }
+
+    static std::int64_t usable(void* const block) noexcept {
+#if defined(__GLIBC__)
+        return malloc_usable_size(block);
+#else
+        // no way to size a block, live bytes aren't tracked
+        (void)block;
+        return 0;
+#endif
+    }
+};
+
+inline MemoryStats g_memory;
+
+// hardware counters per phase for --perf, read at every phase change on
+// the thread that opened them. the counters follow the threads the run
+// starts too. they're one group under the cycles counter, so they're
+// always scheduled together, and when the kernel has to take turns with
+// them the counts are scaled up by the share of time they ran. where the
+// kernel won't hand them out, in containers or under a strict
+// perf_event_paranoid, only the time is kept
+class PerfCounters {
+   public:
+    static constexpr unsigned kEvents = 5;
+    static constexpr char const* kEventNames[kEvents] = {
+        "cycles", "instructions", "branch-misses", "l1d-misses",
+        "llc-misses"};
+
+    // false, and the reason, if no counter could be opened
+    bool open() {
+#if defined(__linux__)
+        constexpr std::uint64_t kL1dReadMiss =
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        constexpr std::pair<std::uint32_t, std::uint64_t> kConfigs[kEvents] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, kL1dReadMiss},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        };
+
+        for (unsigned i = 0; i < kEvents; i++) {
+            perf_event_attr attr = {};
+            attr.size = sizeof attr;
+            attr.type = kConfigs[i].first;
+            attr.config = kConfigs[i].second;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.inherit = 1;
+            // the group starts at once, see below
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // the others join the cycles counter, or go alone without it
+            m_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+                               i == 0 ? -1 : m_fds[0], PERF_FLAG_FD_CLOEXEC);
+            if (m_fds[i] < 0)
+                m_error = std::strerror(errno);
+            else
+                m_counting = true;
+        }
+        if (m_fds[0] >= 0)
+            ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+        m_error = "perf_event_open is linux only";
+#endif
+        m_owner = std::this_thread::get_id();
+        m_last = now();
+        return m_counting;
+    }
+
+    ~PerfCounters() {
+        for (int const fd : m_fds) {
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+
+    bool enabled() const noexcept { return m_owner != std::thread::id(); }
+
+    // charges everything since the last change to the phase that's ending
+    void switch_to(Phase const phase) {
+        if (std::this_thread::get_id() != m_owner)
+            return;
+
+        auto const reading = now();
+        auto& total = m_totals[std::size_t(m_phase)];
+        total.ns += reading.ns - m_last.ns;
+        for (unsigned i = 0; i < kEvents; i++) {
+            std::uint64_t const count = reading.events[i] - m_last.events[i];
+            std::uint64_t const enabled =
+                reading.enabled[i] - m_last.enabled[i];
+            std::uint64_t const running =
+                reading.running[i] - m_last.running[i];
+            if (running < enabled) {
+                m_scaled = true;
+                total.events[i] +=
+                    running ? double(count) * enabled / running : 0;
+            } else {
+                total.events[i] += count;
+            }
+        }
+
+        m_last = reading;
+        m_phase = phase;
+    }
+
+    void count_tokens(std::size_t const n) noexcept { m_tokens += n; }
+    void count_node() noexcept { m_nodes++; }
+    void count_statement() noexcept { m_statements++; }
+
+    void report(std::ostream& out) {
+        switch_to(m_phase);
+
+        char line[160];
+        if (m_counting)
+            std::snprintf(line, sizeof line,
+                          "%-9s %10s %14s %14s %6s %13s %12s %12s\n", "phase",
+                          "ms", kEventNames[0], kEventNames[1], "ipc",
+                          kEventNames[2], kEventNames[3], kEventNames[4]);
+        else
+            std::snprintf(line, sizeof line, "%-9s %10s\n", "phase", "ms");
+        out << line;
+        for (std::size_t p = 0; p < kPhases; p++) {
+            auto const& total = m_totals[p];
+            if (total.ns == 0)
+                continue;
+            std::snprintf(line, sizeof line, "%-9s %10.3f", kPhaseNames[p],
+                          total.ns / 1e6);
+            out << line;
+            if (m_counting) {
+                for (unsigned i = 0; i < kEvents; i++) {
+                    if (i == 2)
+                        out << column(ipc(total), 6, 2);
+                    out << column(total.events[i],
+                                  i < 2 ? 14 : i == 2 ? 13 : 12);
+                }
+            }
+            out << '\n';
+        }
+
+        if (not m_counting) {
+            out << "counters unavailable (" << m_error << "), timings only"
+                << std::endl;
+            return;
+        }
+        if (m_scaled)
+            out << "counters were multiplexed, counts are scaled estimates\n";
+
+        // lexing is per token and parsing per node built. trees of repeated
+        // lines are reused, so executing is per statement run
+        auto const per = [&](Phase const phase, char const* unit,
+                             std::size_t const n) {
+            auto const& total = m_totals[std::size_t(phase)];
+            if (n == 0 or total.ns == 0)
+                return;
+            out << kPhaseNames[std::size_t(phase)] << " per " << unit << ":";
+            for (unsigned i = 0; i < kEvents; i++) {
+                if (m_fds[i] >= 0)
+                    out << column(double(total.events[i]) / n, 0, 2) << ' '
+                        << kEventNames[i];
+            }
+            out << '\n';
+        };
+        per(Phase::Lex, "token", m_tokens);
+        per(Phase::Parse, "node", m_nodes);
+        per(Phase::Execute, "statement", m_statements);
+        out << m_tokens << " tokens, " << m_nodes << " nodes, "
+            << m_statements << " statements" << std::endl;
+    }
+
+   private:
+    struct Reading {
+        std::int64_t ns = 0;
+        std::uint64_t events[kEvents] = {};
+        // how long each counter was enabled and how long it actually ran
+        std::uint64_t enabled[kEvents] = {};
+        std::uint64_t running[kEvents] = {};
+    };
+
+    int m_fds[kEvents] = {-1, -1, -1, -1, -1};
+    bool m_counting = false;
+
+    char const* m_error = "";
+    std::thread::id m_owner;
+    Phase m_phase = Phase::Other;
+    Reading m_last;
+    Reading m_totals[kPhases];
+    std::size_t m_tokens = 0;
+    std::size_t m_nodes = 0;
+    std::size_t m_statements = 0;
+    // whether any count had to be scaled
+    bool m_scaled = false;
+
+    Reading now() const {
+        Reading out;
+        out.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now().time_since_epoch())
+                     .count();
+        for (unsigned i = 0; i < kEvents; i++) {
+            std::uint64_t data[3];
+            if (m_fds[i] < 0 or
+                read(m_fds[i], data, sizeof data) != sizeof data)
+                continue;
+            out.events[i] = data[0];
+            out.enabled[i] = data[1];
+            out.running[i] = data[2];
+        }
+        return out;
+    }
+
+    static double ipc(Reading const& total) noexcept {
+        return total.events[0] ? double(total.events[1]) / total.events[0]
+                               : 0;
+    }
+
+    template <typename Number>
+    std::string column(Number const value,
+                       int const width,
+                       int const decimals = 0) const {
+        char buf[48];
+        std::snprintf(buf, sizeof buf, " %*.*f", width, decimals,
+                      double(value));
+        return buf;
+    }
+};
+
+inline PerfCounters g_perf;
+
+// --trace: begin and end events written out as a chrome trace at exit. each
+// thread appends to a buffer of its own, so recording takes no lock; the
+// buffers are only read after the threads are gone. a buffer is a ring of
+// the thread's latest events, so a long run keeps its end, which is where a
+// stall shows, and a finished thread hands its buffer to the next one
+// started, so the pools don't add buffers with every run
+class Tracer {
+    static constexpr std::size_t kEventsPerThread = 1 << 16;
+
+    struct Event {
+        char const* name;
+        std::int64_t ns;
+        bool begin;
+    };
+
+    struct Buffer {
+        unsigned tid;
+        std::vector<Event> events;
+        // where the next event goes once the ring is full, which is also
+        // where the oldest one is
+        std::size_t next = 0;
+        std::size_t overwritten = 0;
+
+        void push(Event const event) {
+            if (events.size() < kEventsPerThread) {
+                events.push_back(event);
+                return;
+            }
+            events[next] = event;
+            next = (next + 1) % kEventsPerThread;
+            overwritten++;
+        }
+
+        // oldest first
+        template <typename Visit>
+        void for_each(Visit&& visit) const {
+            for (std::size_t i = 0; i < events.size(); i++)
+                visit(events[(next + i) % events.size()]);
+        }
+    };
+
+    // gives the thread's buffer back when the thread ends
+    struct Lease {
+        Tracer* tracer = nullptr;
+        Buffer* buffer = nullptr;
+
+        ~Lease() {
+            if (buffer) {
+                std::lock_guard<std::mutex> lock(tracer->m_mutex);
+                tracer->m_idle.push_back(buffer);
+            }
+        }
+    };
+
+    std::atomic<bool> m_enabled{false};
+    std::int64_t m_start = 0;
+    std::string m_path;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Buffer>> m_buffers;
+    std::vector<Buffer*> m_idle;
+
+    static std::int64_t now() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    Buffer& local() {
+        thread_local Lease lease;
+        if (not lease.buffer) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            lease.tracer = this;
+            if (not m_idle.empty()) {
+                lease.buffer = m_idle.back();
+                m_idle.pop_back();
+            } else {
+                m_buffers.push_back(std::make_unique<Buffer>());
+                lease.buffer = m_buffers.back().get();
+                lease.buffer->tid = m_buffers.size();
+            }
+        }
+        return *lease.buffer;
+    }
+
+   public:
+    void start(std::string path) {
+        m_path = std::move(path);
+        m_start = now();
+        m_enabled = true;
+        // the main thread comes first, as tid 1
+        local();
+    }
+
+    bool enabled() const noexcept {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    void begin(char const* const name) {
+        local().push({name, now() - m_start, true});
+    }
+
+    void end(char const* const name) {
+        local().push({name, now() - m_start, false});
+    }
+
+    // the whole trace, once the threads that wrote it are done. where a
+    // ring went round, the scopes whose begin it lost are begun again at
+    // its oldest event, next to a marker saying how much is missing
+    void write() {
+        std::FILE* const file = std::fopen(m_path.c_str(), "w");
+        if (not file) {
+            std::cerr << "Unable to create \"" << m_path << "\"" << std::endl;
+            return;
+        }
+
+        auto const event = [&](char const* const name, char const phase,
+                               std::int64_t const ns, unsigned const tid) {
+            std::fprintf(file,
+                         ",\n{\"name\": \"%s\", \"ph\": \"%c\", "
+                         "\"ts\": %.3f, \"pid\": 1, \"tid\": %u%s}",
+                         name, phase, ns / 1e3, tid,
+                         phase == 'i' ? ", \"s\": \"t\"" : "");
+        };
+
+        std::fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n", file);
+        bool first = true;
+        std::size_t dropped = 0;
+        for (auto const& buffer : m_buffers) {
+            std::string const name = buffer->tid == 1
+                                         ? "main"
+                                         : "thread " + std::to_string(buffer->tid);
+            std::fprintf(file,
+                         "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+                         "\"pid\": 1, \"tid\": %u, \"args\": {\"name\": "
+                         "\"%s\"}}",
+                         first ? "" : ",\n", buffer->tid, name.c_str());
+            first = false;
+
+            if (buffer->overwritten) {
+                dropped += buffer->overwritten;
+
+                // ends without a begin, innermost first
+                std::vector<char const*> open;
+                std::size_t depth = 0;
+                buffer->for_each([&](Event const& e) {
+                    if (e.begin)
+                        depth++;
+                    else if (depth)
+                        depth--;
+                    else
+                        open.push_back(e.name);
+                });
+
+                std::int64_t const oldest =
+                    buffer->events[buffer->next].ns;
+                std::string const marker =
+                    std::to_string(buffer->overwritten) +
+                    " earlier events dropped";
+                event(marker.c_str(), 'i', oldest, buffer->tid);
+                for (auto it = open.rbegin(); it != open.rend(); ++it)
+                    event(*it, 'B', oldest, buffer->tid);
+            }
+
+            buffer->for_each([&](Event const& e) {
+                event(e.name, e.begin ? 'B' : 'E', e.ns, buffer->tid);
+            });
+        }
+        std::fprintf(file, "\n], \"otherData\": {\"dropped\": %zu}}\n",
+                     dropped);
+
+        if (std::fclose(file) != 0)
+            std::cerr << "Write to \"" << m_path << "\" failed" << std::endl;
+    }
+};
+
+inline Tracer g_trace;
+
+// a begin and end event around the scope, when tracing. `name` has to
+// outlive the run, a literal
+class TraceScope {
+    char const* m_name = nullptr;
+
+   public:
+    explicit TraceScope(char const* const name) {
+        if (g_trace.enabled()) {
+            m_name = name;
+            g_trace.begin(name);
+        }
+    }
+    ~TraceScope() {
+        if (m_name)
+            g_trace.end(m_name);
+    }
+
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+};
+
+// marks what the program is doing until the end of the scope, then the
+// enclosing phase takes over again
+class PhaseScope {
+    Phase m_previous;
+    TraceScope m_trace;
+
+   public:
+    explicit PhaseScope(Phase const phase)
+        : m_previous(std::exchange(g_phase, phase)),
+          m_trace(kPhaseNames[std::size_t(phase)]) {
+        if (g_perf.enabled())
+            g_perf.switch_to(phase);
+    }
+    ~PhaseScope() {
+        g_phase = m_previous;
+        if (g_perf.enabled())
+            g_perf.switch_to(m_previous);
+    }
+
+    PhaseScope(PhaseScope const&) = delete;
+    PhaseScope& operator=(PhaseScope const&) = delete;
+};
+
+void* operator new(std::size_t const bytes) {
+    void* const block = std::malloc(bytes ? bytes : 1);
+    if (not block)
+        throw std::bad_alloc();
+    if (g_memory.tracking.load(std::memory_order_relaxed))
+        g_memory.allocated(block, bytes);
+    return block;
+}
+
+void operator delete(void* const block) noexcept {
+    if (block and g_memory.tracking.load(std::memory_order_relaxed))
+        g_memory.released(block);
+    std::free(block);
+}
+
+void operator delete(void* const block, std::size_t) noexcept {
+    operator delete(block);
+}
+
 struct Range {
     unsigned start, end;
 };
 
 struct CompileContext {
-    std::string src;
+    std::string_view src;
 
     std::string get_from_range(Range const range) const noexcept {
-        return src.substr(range.start, range.end - range.start);
+        return std::string(src.substr(range.start, range.end - range.start));
     }
 };
 
@@ -29,9 +592,30 @@ class Token {
         Solidus,
         LeftParanthesis,
         RightParanthesis,
+        LeftBracket,
+        RightBracket,
         Equals,
 
+        EqualsEquals,
+        ExclamationEquals,
+        Less,
+        LessEquals,
+        Greater,
+        GreaterEquals,
+        QuestionMark,
+        Colon,
+        Comma,
+
+        // keywords, lexed from identifiers
+        And,
+        Or,
+        Not,
+
         Identifier,
+
+        // marks the end of the token stream, so the parser never has to
+        // bounds-check before peeking
+        End,
     };
 
     std::string debug_print() const noexcept {
@@ -44,6 +628,7 @@ class Token {
 
             case Type::Identifier:
                 out += "Ident";
+                break;
 
             case Type::Plus:
                 out += "Plus";
@@ -63,11 +648,59 @@ class Token {
             case Type::RightParanthesis:
                 out += "RightParanthesis";
                 break;
+            case Type::LeftBracket:
+                out += "LeftBracket";
+                break;
+            case Type::RightBracket:
+                out += "RightBracket";
+                break;
 
             case Type::Equals:
                 out += "Equals";
                 break;
 
+            case Type::EqualsEquals:
+                out += "EqualsEquals";
+                break;
+            case Type::ExclamationEquals:
+                out += "ExclamationEquals";
+                break;
+            case Type::Less:
+                out += "Less";
+                break;
+            case Type::LessEquals:
+                out += "LessEquals";
+                break;
+            case Type::Greater:
+                out += "Greater";
+                break;
+            case Type::GreaterEquals:
+                out += "GreaterEquals";
+                break;
+            case Type::QuestionMark:
+                out += "QuestionMark";
+                break;
+            case Type::Colon:
+                out += "Colon";
+                break;
+            case Type::Comma:
+                out += "Comma";
+                break;
+
+            case Type::And:
+                out += "And";
+                break;
+            case Type::Or:
+                out += "Or";
+                break;
+            case Type::Not:
+                out += "Not";
+                break;
+
+            case Type::End:
+                out += "End";
+                break;
+
             default:
                 out += "unimplemented";
         };
@@ -81,8 +714,11 @@ class Token {
     Range m_range;
 };
 
-std::vector<Token> tokenize(std::string const& input) {
-    std::vector<Token> toks{};
+// into `toks`, which is cleared first, so a caller that keeps it around
+// reuses its storage
+void tokenize(std::string const& input, std::vector<Token>& toks) {
+    PhaseScope const phase(Phase::Lex);
+    toks.clear();
 
     for (unsigned idx = 0; idx < input.length(); idx++) {
         switch (input[idx]) {
@@ -127,12 +763,88 @@ std::vector<Token> tokenize(std::string const& input) {
                           .m_range = {.start = idx, .end = idx + 1}});
                 break;
 
+            case '[':
+                toks.push_back(
+                    Token{.m_type = Token::Type::LeftBracket,
+                          .m_range = {.start = idx, .end = idx + 1}});
+                break;
+
+            case ']':
+                toks.push_back(
+                    Token{.m_type = Token::Type::RightBracket,
+                          .m_range = {.start = idx, .end = idx + 1}});
+                break;
+
             case '=':
+                if (input[idx + 1] == '=') {
+                    toks.push_back(
+                        Token{.m_type = Token::Type::EqualsEquals,
+                              .m_range = {.start = idx, .end = idx + 2}});
+                    idx += 1;
+                    break;
+                }
+
                 toks.push_back(
                     Token{.m_type = Token::Type::Equals,
                           .m_range = {.start = idx, .end = idx + 1}});
                 break;
 
+            case '!':
+                if (input[idx + 1] != '=')
+                    throw std::runtime_error("Expected '=' after '!'\n");
+
+                toks.push_back(
+                    Token{.m_type = Token::Type::ExclamationEquals,
+                          .m_range = {.start = idx, .end = idx + 2}});
+                idx += 1;
+                break;
+
+            case '<':
+                if (input[idx + 1] == '=') {
+                    toks.push_back(
+                        Token{.m_type = Token::Type::LessEquals,
+                              .m_range = {.start = idx, .end = idx + 2}});
+                    idx += 1;
+                    break;
+                }
+
+                toks.push_back(
+                    Token{.m_type = Token::Type::Less,
+                          .m_range = {.start = idx, .end = idx + 1}});
+                break;
+
+            case '>':
+                if (input[idx + 1] == '=') {
+                    toks.push_back(
+                        Token{.m_type = Token::Type::GreaterEquals,
+                              .m_range = {.start = idx, .end = idx + 2}});
+                    idx += 1;
+                    break;
+                }
+
+                toks.push_back(
+                    Token{.m_type = Token::Type::Greater,
+                          .m_range = {.start = idx, .end = idx + 1}});
+                break;
+
+            case '?':
+                toks.push_back(
+                    Token{.m_type = Token::Type::QuestionMark,
+                          .m_range = {.start = idx, .end = idx + 1}});
+                break;
+
+            case ':':
+                toks.push_back(
+                    Token{.m_type = Token::Type::Colon,
+                          .m_range = {.start = idx, .end = idx + 1}});
+                break;
+
+            case ',':
+                toks.push_back(
+                    Token{.m_type = Token::Type::Comma,
+                          .m_range = {.start = idx, .end = idx + 1}});
+                break;
+
             default: {
                 unsigned start = idx;
 
@@ -149,11 +861,23 @@ std::vector<Token> tokenize(std::string const& input) {
                 } else if (isalpha(input[idx])) {
                     unsigned start = idx;
 
-                    while (isalnum(input[idx]))
+                    // underscores too, so the _lo and _hi columns of an
+                    // interval run can be read back
+                    while (isalnum(input[idx]) or input[idx] == '_')
                         idx += 1;
 
+                    auto const word =
+                        std::string_view(input).substr(start, idx - start);
+                    auto type = Token::Type::Identifier;
+                    if (word == "and")
+                        type = Token::Type::And;
+                    else if (word == "or")
+                        type = Token::Type::Or;
+                    else if (word == "not")
+                        type = Token::Type::Not;
+
                     toks.push_back(
-                        Token{.m_type = Token::Type::Identifier,
+                        Token{.m_type = type,
                               .m_range = {.start = start, .end = idx}});
 
                     // dumb hack
@@ -166,274 +890,7116 @@ std::vector<Token> tokenize(std::string const& input) {
         }
     }
 
-    return toks;
+    toks.push_back(Token{
+        .m_type = Token::Type::End,
+        .m_range = {.start = unsigned(input.length()),
+                    .end = unsigned(input.length())}});
+
+    if (g_perf.enabled())
+        g_perf.count_tokens(toks.size());
 }
 
-class VirtualMachine {
-    std::vector<double> m_stack;
-    std::unordered_map<std::string, double> m_variables;
+std::vector<Token> tokenize(std::string const& input) {
+    std::vector<Token> toks;
+    tokenize(input, toks);
+    return toks;
+}
 
+// a number or an array of numbers, nan-boxed into 8 bytes. a number is
+// stored as its own bits; an array is a quiet nan whose sign, exponent and
+// top payload bits spell kArrayTag and whose low 48 bits point at a
+// refcounted box. telling them apart is one mask and compare, and numbers
+// never touch the heap. arrays are immutable once built, so copies of a
+// value share them
+class Value {
    public:
-    void push(double const d) { m_stack.push_back(d); }
+    using Array = std::vector<double>;
 
-    double pop() {
-        auto const out = m_stack.back();
-        m_stack.pop_back();
-        return out;
+    Value(double const number = 0) noexcept {
+        std::memcpy(&m_bits, &number, sizeof m_bits);
+        // a nan that happens to look like a box is stored as a plain one
+        if ((m_bits & kTagMask) == kArrayTag)
+            m_bits = kPlainNan;
     }
+    // a non-zero `cols` makes the array a row-major matrix
+    Value(std::shared_ptr<Array const> array, std::size_t const cols = 0) {
+        if (not array)
+            return;
+        auto* const box = new Box{.refs = {1},
+                                  .array = std::move(array),
+                                  .cols = cols};
+        m_bits = kArrayTag | reinterpret_cast<std::uintptr_t>(box);
+    }
+    Value(std::shared_ptr<Array> array, std::size_t const cols = 0)
+        : Value(std::shared_ptr<Array const>(std::move(array)), cols) {}
 
-    unsigned stack_size() const noexcept { return m_stack.size(); }
+    Value(Value const& other) noexcept : m_bits(other.m_bits) {
+        if (is_array())
+            box()->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    Value(Value&& other) noexcept : m_bits(other.m_bits) {
+        other.m_bits = 0;
+    }
+    Value& operator=(Value const& other) noexcept {
+        Value copy(other);
+        std::swap(m_bits, copy.m_bits);
+        return *this;
+    }
+    Value& operator=(Value&& other) noexcept {
+        std::swap(m_bits, other.m_bits);
+        return *this;
+    }
+    ~Value() {
+        if (is_array() and
+            box()->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete box();
+    }
 
-    void set(std::string const& str, double const d) { m_variables[str] = d; }
-    double get(std::string const& str) { return m_variables[str]; }
-};
+    bool is_array() const noexcept {
+        return (m_bits & kTagMask) == kArrayTag;
+    }
+    bool is_matrix() const noexcept { return cols() != 0; }
+    std::size_t cols() const noexcept { return is_array() ? box()->cols : 0; }
+    std::size_t rows() const noexcept {
+        return cols() == 0 ? 0 : box()->array->size() / cols();
+    }
 
-class Node {
-   protected:
-    Node() = default;
+    double number() const {
+        if (is_array())
+            throw std::runtime_error("Expected a number but got an array\n");
+        double out;
+        std::memcpy(&out, &m_bits, sizeof out);
+        return out;
+    }
 
-   public:
-    virtual void execute(VirtualMachine& vm) = 0;
-    virtual ~Node() = default;
-};
+    Array const& array() const {
+        if (not is_array())
+            throw std::runtime_error("Expected an array but got a number\n");
+        return *box()->array;
+    }
 
-class IdentNode : public Node {
-    std::string m_ident;
+    // the array itself, for results that reuse it under another shape
+    std::shared_ptr<Array const> shared_array() const {
+        array();
+        return box()->array;
+    }
 
-   public:
-    IdentNode(std::string const& ident) : m_ident(ident) {}
+   private:
+    struct Box {
+        std::atomic<std::size_t> refs;
+        std::shared_ptr<Array const> array;
+        std::size_t cols;
+    };
 
-    virtual void execute(VirtualMachine& vm) override {
-        vm.push(vm.get(m_ident));
+    // negative quiet nan with the payload bit below the quiet bit set,
+    // something arithmetic never produces
+    static constexpr std::uint64_t kTagMask = 0xffff'0000'0000'0000;
+    static constexpr std::uint64_t kArrayTag = 0xfff9'0000'0000'0000;
+    static constexpr std::uint64_t kPlainNan = 0x7ff8'0000'0000'0000;
+    static_assert(sizeof(void*) == 8, "boxes need 64-bit pointers");
+
+    Box* box() const noexcept {
+        return reinterpret_cast<Box*>(m_bits & ~kTagMask);
     }
+
+    std::uint64_t m_bits = 0;
 };
 
-class AssignmentNode : public Node {
-    std::string m_name;
-    std::unique_ptr<Node> m_rhs;
+static_assert(sizeof(Value) == 8);
 
-   public:
-    AssignmentNode(std::string const& name, std::unique_ptr<Node>&& rhs)
-        : m_name(name), m_rhs(std::move(rhs)) {}
+// open addressing map from names to V, for the variable tables. one control
+// byte per slot, either empty or 7 bits of the name's hash, and the entries
+// in one flat array next to it. a probe compares a group of 16 control bytes
+// at once and only looks at the entries whose bits match, so a miss rarely
+// touches an entry at all. names up to 15 characters sit inside the entry,
+// in std::string's own buffer. there's no erase: variables only ever come
+// into being
+template <typename V>
+class FlatMap {
+    static constexpr std::size_t kGroup = 16;
+    static constexpr std::int8_t kEmpty = -128;
 
-    virtual void execute(VirtualMachine& vm) override {
-        m_rhs->execute(vm);
+    struct Entry {
+        std::string key;
+        V value;
+    };
+
+    std::vector<std::int8_t> m_control;
+    std::vector<Entry> m_entries;
+    std::size_t m_size = 0;
 
-        vm.set(m_name, vm.pop());
+    // bit i set where control byte i of the group equals `byte`
+    static std::uint32_t match(std::int8_t const* const group,
+                               std::int8_t const byte) noexcept {
+#if defined(__SSE2__)
+        __m128i const bytes =
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(group));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(byte)));
+#else
+        std::uint32_t out = 0;
+        for (std::size_t i = 0; i < kGroup; i++)
+            out |= std::uint32_t(group[i] == byte) << i;
+        return out;
+#endif
     }
-};
 
-class NumberNode : public Node {
-    double m_number;
+    static std::size_t hash(std::string_view const key) noexcept {
+        return std::hash<std::string_view>{}(key);
+    }
 
-   public:
-    NumberNode(double number) : m_number(number) {}
+    // the slot holding `key`, or else the empty one it would go into
+    std::pair<std::size_t, bool> probe(std::string_view const key,
+                                       std::size_t const hash) const {
+        std::int8_t const tag = hash & 0x7f;
+        std::size_t const groups = m_control.size() / kGroup;
 
-    virtual void execute(VirtualMachine& vm) override { vm.push(m_number); }
-};
+        for (std::size_t group = (hash >> 7) & (groups - 1);;
+             group = (group + 1) & (groups - 1)) {
+            std::int8_t const* const control = &m_control[group * kGroup];
+            for (auto bits = match(control, tag); bits; bits &= bits - 1) {
+                std::size_t const slot = group * kGroup + __builtin_ctz(bits);
+                if (m_entries[slot].key == key)
+                    return {slot, true};
+            }
+            // the table never fills up, so every probe ends at an empty slot
+            if (auto const empty = match(control, kEmpty))
+                return {group * kGroup + __builtin_ctz(empty), false};
+        }
+    }
+
+    void grow() {
+        std::vector<std::int8_t> control(
+            std::max(kGroup, m_control.size() * 2), kEmpty);
+        std::vector<Entry> entries(control.size());
+        std::swap(control, m_control);
+        std::swap(entries, m_entries);
+
+        for (std::size_t slot = 0; slot < control.size(); slot++) {
+            if (control[slot] == kEmpty)
+                continue;
+            auto const& key = entries[slot].key;
+            std::size_t const to = probe(key, hash(key)).first;
+            m_control[to] = control[slot];
+            m_entries[to] = std::move(entries[slot]);
+        }
+    }
+
+   public:
+    std::size_t size() const noexcept { return m_size; }
+    // changes when the entries move
+    std::size_t capacity() const noexcept { return m_entries.size(); }
+
+    V* find(std::string_view const key) {
+        if (m_size == 0)
+            return nullptr;
+        auto const [slot, found] = probe(key, hash(key));
+        return found ? &m_entries[slot].value : nullptr;
+    }
+
+    V const* find(std::string_view const key) const {
+        return const_cast<FlatMap*>(this)->find(key);
+    }
+
+    // the value of `key`, default constructed if it's new
+    V& operator[](std::string_view const key) {
+        // grows at 7/8 full
+        if ((m_size + 1) * 8 > capacity() * 7)
+            grow();
+
+        std::size_t const hashed = hash(key);
+        auto const [slot, found] = probe(key, hashed);
+        if (not found) {
+            m_control[slot] = hashed & 0x7f;
+            m_entries[slot].key = key;
+            m_size++;
+        }
+        return m_entries[slot].value;
+    }
+
+    template <typename Visit>
+    void for_each(Visit&& visit) const {
+        for (std::size_t slot = 0; slot < m_control.size(); slot++) {
+            if (m_control[slot] != kEmpty)
+                visit(m_entries[slot].key, m_entries[slot].value);
+        }
+    }
+};
+
+struct Program;
+
+// the stack and the variables of a machine holding values of type T. the
+// tree walker runs on VirtualMachine, the Value instantiation with arrays
+// and builtins. the other number modes run compiled stack code on their own
+// instantiation, see run(), where the stack and the variables only ever
+// hold Ts and every operation is resolved at compile time through
+// Arithmetic<T>
+template <typename T>
+class BasicVirtualMachine {
+    std::vector<T> m_stack;
+    FlatMap<T> m_variables;
+    unsigned m_threads = std::max(1u, std::thread::hardware_concurrency());
+    // changes whenever variable storage may have moved. drawn from one
+    // counter for all machines, so a cache filled by another machine never
+    // matches
+    std::uint64_t m_epoch = next_epoch();
+
+    static std::uint64_t next_epoch() noexcept {
+        static std::atomic<std::uint64_t> counter{1};
+        return counter++;
+    }
+
+   public:
+    void push(T d) { m_stack.push_back(std::move(d)); }
+
+    T pop_value() {
+        auto out = std::move(m_stack.back());
+        m_stack.pop_back();
+        return out;
+    }
+
+    // for the places that only make sense on numbers
+    double pop() { return pop_value().number(); }
+
+    T const& peek(unsigned const depth = 0) const {
+        return m_stack[m_stack.size() - 1 - depth];
+    }
+
+    unsigned stack_size() const noexcept { return m_stack.size(); }
+
+    // drops whatever a failed statement left behind
+    void clear_stack() noexcept { m_stack.clear(); }
+
+    void set(std::string const& str, T d) { slot(str) = std::move(d); }
+    // the value of a variable, 0 if it doesn't exist. never creates it
+    T get(std::string const& str) const {
+        auto const* const found = m_variables.find(str);
+        return found ? *found : T();
+    }
+
+    // storage of a variable, made 0 if it doesn't exist yet. valid for as
+    // long as epoch() stays the same. everything that may add a variable
+    // goes through here, so the epoch moves whenever the table grows
+    T& slot(std::string const& str) {
+        PhaseScope const phase(Phase::Variables);
+        auto const capacity = m_variables.capacity();
+        auto& out = m_variables[str];
+        if (m_variables.capacity() != capacity)
+            m_epoch = next_epoch();
+        return out;
+    }
+    std::uint64_t epoch() const noexcept { return m_epoch; }
+
+    bool has(std::string const& str) const {
+        return m_variables.find(str) != nullptr;
+    }
+    std::size_t variable_count() const noexcept { return m_variables.size(); }
+
+    // how many threads the array builtins may use
+    unsigned threads() const noexcept { return m_threads; }
+    void set_threads(unsigned const threads) noexcept { m_threads = threads; }
+
+    // runs compiled stack code, leaving the stack empty. the value of an
+    // expression, nothing for an assignment
+    std::optional<T> run(Program const& program);
+};
+
+using VirtualMachine = BasicVirtualMachine<Value>;
+
+// what an IdentNode or AssignmentNode remembers of its variable between
+// runs: the storage, checked against the machine's epoch before each use
+class VariableCache {
+    Value* m_slot = nullptr;
+    std::uint64_t m_epoch = 0;
+
+   public:
+    Value& get(VirtualMachine& vm, std::string const& name) {
+        if (m_epoch != vm.epoch()) {
+            m_slot = &vm.slot(name);
+            m_epoch = vm.epoch();
+        }
+        return *m_slot;
+    }
+};
+
+// runs `work(chunk, worker)` for every chunk index on a pool of threads, in
+// no particular order
+template <typename Work>
+void run_chunks(std::size_t const count, unsigned const threads, Work&& work) {
+    std::atomic<std::size_t> next{0};
+    std::mutex mutex;
+    std::exception_ptr error;
+
+    Phase const phase = g_phase;
+    auto worker = [&](unsigned const worker_idx) {
+        g_phase = phase;
+        TraceScope const trace("worker");
+        for (;;) {
+            std::size_t const idx = next++;
+            if (idx >= count)
+                return;
+
+            try {
+                TraceScope const chunk("chunk");
+                work(idx, worker_idx);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (not error)
+                    error = std::current_exception();
+                // make the others run out of work
+                next = count;
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker, i);
+    for (auto& thread : pool)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// length of the result of an elementwise operation. scalars broadcast,
+// arrays all have to be the same length
+inline std::size_t broadcast_length(std::initializer_list<Value const*> values) {
+    std::optional<std::size_t> length;
+    for (auto const* value : values) {
+        if (not value->is_array())
+            continue;
+        if (length and *length != value->array().size())
+            throw std::runtime_error("Array lengths differ\n");
+        length = value->array().size();
+    }
+
+    return length.value_or(1);
+}
+
+// shape of the result of an elementwise operation: matrices keep it, as long
+// as they agree on it
+inline std::size_t broadcast_cols(std::initializer_list<Value const*> values) {
+    std::size_t cols = 0;
+    for (auto const* value : values) {
+        if (not value->is_matrix())
+            continue;
+        if (cols != 0 and cols != value->cols())
+            throw std::runtime_error("Matrix shapes differ\n");
+        cols = value->cols();
+    }
+
+    return cols;
+}
+
+// `length` values of `value`: the array itself, or the scalar repeated into
+// `storage`
+inline double const* broadcast(Value const& value,
+                               std::size_t const length,
+                               std::vector<double>& storage) {
+    if (value.is_array())
+        return value.array().data();
+
+    storage.assign(length, value.number());
+    return storage.data();
+}
+
+inline std::shared_ptr<Value::Array> make_array(std::size_t const length) {
+    return std::make_shared<Value::Array>(length);
+}
+
+// instruction sets the kernels are compiled for. sse2 stands for the
+// baseline build on other architectures
+enum class Isa {
+    Sse2,
+    Avx2,
+    Avx512,
+};
+
+constexpr char const* kIsaNames[] = {"sse2", "avx2", "avx512"};
+
+// the best isa the cpu supports, from cpuid
+Isa detect_isa() {
+#if defined(CALC_ISA_CLONES)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") and
+        __builtin_cpu_supports("avx512bw") and
+        __builtin_cpu_supports("avx512vl") and __builtin_cpu_supports("fma"))
+        return Isa::Avx512;
+    if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+        return Isa::Avx2;
+#endif
+    return Isa::Sse2;
+}
+
+Isa const g_detected_isa = detect_isa();
+
+// what the kernels dispatch on. only ever lowered, by --isa, before any
+// work starts
+Isa g_isa = g_detected_isa;
+
+#if defined(CALC_ISA_CLONES)
+#define ISA_AVX2 __attribute__((target("avx2,fma")))
+#define ISA_AVX512 \
+    __attribute__((target("avx512f,avx512bw,avx512vl,avx2,fma")))
+#else
+#define ISA_AVX2
+#define ISA_AVX512
+#endif
+
+// defines `name` as a dispatcher over one clone of `name##_body` per isa.
+// the body is force-inlined into every clone, so the compiler vectorizes it
+// for that clone's target. `specifiers` is `static` inside classes, and
+// starts with a template header for kernels generic over the element type
+#define ISA_INLINE inline __attribute__((always_inline))
+#define ISA_DISPATCH(specifiers, ret, name, params, args)                 \
+    specifiers ret name##_sse2 params { return name##_body args; }        \
+    specifiers ISA_AVX2 ret name##_avx2 params {                          \
+        return name##_body args;                                          \
+    }                                                                     \
+    specifiers ISA_AVX512 ret name##_avx512 params {                      \
+        return name##_body args;                                          \
+    }                                                                     \
+    specifiers ret name params {                                          \
+        static ret(*const clones[]) params = {name##_sse2, name##_avx2,   \
+                                              name##_avx512};             \
+        return clones[int(g_isa)] args;                                   \
+    }
+
+// number of rows the column engine evaluates at once. small enough that the
+// scratch blocks of a typical expression stay in L1/L2, big enough that the
+// per-node virtual call disappears in the noise
+constexpr std::size_t kBlockRows = 1024;
+
+// maps column names onto the slots of a BlockFrame, and remembers which of
+// them an expression actually reads so the loaders can skip the rest
+class ColumnSchema {
+    std::vector<std::string> m_names;
+    std::vector<bool> m_used;
+
+   public:
+    unsigned add(std::string const& name) {
+        m_names.push_back(name);
+        m_used.push_back(false);
+        return m_names.size() - 1;
+    }
+
+    // later columns shadow earlier ones of the same name, so an expression
+    // can refer to the output of the one before it
+    std::optional<unsigned> use(std::string const& name) {
+        for (unsigned slot = m_names.size(); slot-- > 0;) {
+            if (m_names[slot] == name) {
+                m_used[slot] = true;
+                return slot;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    void use_all() { m_used.assign(m_used.size(), true); }
+    bool used(unsigned slot) const noexcept { return m_used[slot]; }
+    unsigned size() const noexcept { return m_names.size(); }
+};
+
+// stack of kBlockRows sized buffers for intermediate results. one per
+// worker thread, reused for every block
+template <typename T>
+class BlockScratch {
+    std::vector<std::unique_ptr<T[]>> m_buffers;
+    unsigned m_top = 0;
+
+   public:
+    T* acquire() {
+        if (m_top == m_buffers.size())
+            m_buffers.push_back(std::make_unique<T[]>(kBlockRows));
+        return m_buffers[m_top++].get();
+    }
+
+    void release() noexcept { m_top -= 1; }
+};
+
+// blocks are evaluated in the precision of the run, double or float
+template <typename T>
+struct BlockFrame {
+    // one pointer per schema slot, each to `rows` values. null for slots
+    // no expression reads
+    std::vector<T const*> columns;
+    std::size_t rows;
+    BlockScratch<T>& scratch;
+};
+
+// maps doubles onto unsigned keys with the same order: non-negative values
+// get their sign bit set, negative ones are inverted entirely. sorting the
+// keys as integers sorts the values, with NaNs at the ends by their sign
+inline std::uint64_t order_key(double const value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (std::uint64_t(1) << 63);
+}
+
+inline double from_order_key(std::uint64_t const key) {
+    std::uint64_t const bits =
+        key >> 63 ? key & ~(std::uint64_t(1) << 63) : ~key;
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// below this many keys a comparison sort beats the radix passes
+constexpr std::size_t kRadixSortMin = std::size_t(1) << 16;
+
+// lsd radix sort, 11 bits per pass. each pass counts digits over one slice
+// per thread, turns the counts into per-thread scatter offsets, and
+// scatters the slices in parallel, which keeps it stable
+void radix_sort(std::uint64_t* keys, std::size_t const n, unsigned threads) {
+    if (n < kRadixSortMin) {
+        std::sort(keys, keys + n);
+        return;
+    }
+
+    constexpr unsigned kDigitBits = 11;
+    constexpr std::size_t kDigits = std::size_t(1) << kDigitBits;
+
+    threads = std::max<std::size_t>(
+        1, std::min<std::size_t>(threads, n / kRadixSortMin));
+    std::size_t const slice = (n + threads - 1) / threads;
+
+    std::vector<std::uint64_t> buffer(n);
+    std::uint64_t* from = keys;
+    std::uint64_t* to = buffer.data();
+    std::vector<std::size_t> offsets(threads * kDigits);
+
+    for (unsigned shift = 0; shift < 64; shift += kDigitBits) {
+        auto digit = [shift](std::uint64_t const key) {
+            return (key >> shift) & (kDigits - 1);
+        };
+
+        std::fill(offsets.begin(), offsets.end(), 0);
+        run_chunks(threads, threads, [&](std::size_t t, unsigned) {
+            std::size_t* const counts = offsets.data() + t * kDigits;
+            for (std::size_t i = t * slice; i < std::min(n, (t + 1) * slice);
+                 i++)
+                counts[digit(from[i])] += 1;
+        });
+
+        // a digit every key shares doesn't reorder anything
+        std::size_t shared = 0;
+        for (unsigned t = 0; t < threads; t++)
+            shared += offsets[t * kDigits + digit(from[0])];
+        if (shared == n)
+            continue;
+
+        std::size_t offset = 0;
+        for (std::size_t d = 0; d < kDigits; d++) {
+            for (unsigned t = 0; t < threads; t++) {
+                std::size_t const count = offsets[t * kDigits + d];
+                offsets[t * kDigits + d] = offset;
+                offset += count;
+            }
+        }
+
+        run_chunks(threads, threads, [&](std::size_t t, unsigned) {
+            std::size_t* const next = offsets.data() + t * kDigits;
+            for (std::size_t i = t * slice; i < std::min(n, (t + 1) * slice);
+                 i++)
+                to[next[digit(from[i])]++] = from[i];
+        });
+
+        std::swap(from, to);
+    }
+
+    if (from != keys)
+        std::copy_n(from, n, keys);
+}
+
+// moves the k-th smallest of a[left..right] to a[k], with nothing bigger
+// before it and nothing smaller after (Floyd-Rivest). a small sample around
+// the expected position picks pivots that shrink the range to about
+// sqrt(n) per round. if that keeps failing, which only crafted inputs
+// manage, it gives up and hands the range to introselect. no NaNs allowed
+void select_kth(double* a,
+                std::ptrdiff_t left,
+                std::ptrdiff_t right,
+                std::ptrdiff_t const k,
+                unsigned budget) {
+    while (right > left) {
+        if (budget-- == 0) {
+            std::nth_element(a + left, a + k, a + right + 1);
+            return;
+        }
+
+        if (right - left > 600) {
+            double const n = right - left + 1;
+            double const i = k - left + 1;
+            double const z = std::log(n);
+            double const s = 0.5 * std::exp(2 * z / 3);
+            double const sd = 0.5 * std::sqrt(z * s * (n - s) / n) *
+                              (i - n / 2 < 0 ? -1 : 1);
+            auto const new_left = std::max(
+                left, std::ptrdiff_t(std::floor(k - i * s / n + sd)));
+            auto const new_right = std::min(
+                right, std::ptrdiff_t(std::floor(k + (n - i) * s / n + sd)));
+            select_kth(a, new_left, new_right, k, budget);
+        }
+
+        double const pivot = a[k];
+        std::ptrdiff_t i = left, j = right;
+
+        std::swap(a[left], a[k]);
+        if (a[right] > pivot)
+            std::swap(a[right], a[left]);
+
+        while (i < j) {
+            std::swap(a[i], a[j]);
+            i += 1;
+            j -= 1;
+            while (a[i] < pivot)
+                i += 1;
+            while (a[j] > pivot)
+                j -= 1;
+        }
+
+        if (a[left] == pivot) {
+            std::swap(a[left], a[j]);
+        } else {
+            j += 1;
+            std::swap(a[j], a[right]);
+        }
+
+        if (j <= k)
+            left = j + 1;
+        if (k <= j)
+            right = j - 1;
+    }
+}
+
+inline unsigned select_budget(std::size_t const n) {
+    return 2 * (64 - __builtin_clzll(n | 1));
+}
+
+// puts every rank in the sorted `ranks` into place at once. selecting the
+// middle rank splits the range, and the ranks on each side only need to be
+// looked for on that side, so q ranks cost O(n log q) instead of a full sort
+void select_ranks(double* a,
+                  std::size_t const begin,
+                  std::size_t const end,
+                  std::size_t const* ranks_begin,
+                  std::size_t const* ranks_end) {
+    if (ranks_begin == ranks_end or end - begin < 2)
+        return;
+
+    std::size_t const* const mid = ranks_begin + (ranks_end - ranks_begin) / 2;
+    select_kth(a, begin, end - 1, *mid, select_budget(end - begin));
+
+    select_ranks(a, begin, *mid, ranks_begin, mid);
+    select_ranks(a, *mid + 1, end, mid + 1, ranks_end);
+}
+
+// the values at `ps` percent (0 to 100) of `values`, interpolating between
+// the two closest ranks. NaNs are left out
+std::vector<double> percentiles(Value::Array const& values,
+                                std::vector<double> const& ps) {
+    std::vector<double> data;
+    data.reserve(values.size());
+    for (double const value : values) {
+        if (value == value)
+            data.push_back(value);
+    }
+
+    std::size_t const n = data.size();
+    std::vector<std::size_t> ranks;
+    for (double const p : ps) {
+        if (not(p >= 0 and p <= 100))
+            throw std::runtime_error("Percentiles go from 0 to 100\n");
+        if (n == 0)
+            continue;
+
+        std::size_t const lower = std::floor(p / 100 * (n - 1));
+        ranks.push_back(lower);
+        if (lower + 1 < n)
+            ranks.push_back(lower + 1);
+    }
+
+    std::sort(ranks.begin(), ranks.end());
+    ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+    select_ranks(data.data(), 0, n, ranks.data(), ranks.data() + ranks.size());
+
+    std::vector<double> out;
+    for (double const p : ps) {
+        if (n == 0) {
+            out.push_back(std::numeric_limits<double>::quiet_NaN());
+            continue;
+        }
+
+        double const pos = p / 100 * (n - 1);
+        std::size_t const lower = std::floor(pos);
+        double const frac = pos - lower;
+        out.push_back(frac == 0 ? data[lower]
+                                : data[lower] +
+                                      frac * (data[lower + 1] - data[lower]));
+    }
+
+    return out;
+}
+
+// a function callable from expressions. it gets its evaluated arguments,
+// already checked against min_args/max_args
+struct Builtin {
+    char const* name;
+    unsigned min_args, max_args;
+    Value (*call)(std::vector<Value> const& args, VirtualMachine& vm);
+};
+
+Value builtin_len(std::vector<Value> const& args, VirtualMachine&) {
+    return double(args[0].array().size());
+}
+
+// range(n) is 0, 1, ... n-1 and range(a, b) is a, a+1, ... b-1
+Value builtin_range(std::vector<Value> const& args, VirtualMachine&) {
+    double const start = args.size() == 2 ? args[0].number() : 0;
+    double const stop = args.back().number();
+    double const length = std::ceil(stop - start);
+    if (not(length < 1e10))
+        throw std::runtime_error("Range is too long\n");
+
+    auto out = make_array(std::max(0.0, length));
+    for (std::size_t i = 0; i < out->size(); i++)
+        (*out)[i] = start + i;
+    return out;
+}
+
+Value builtin_sort(std::vector<Value> const& args, VirtualMachine& vm) {
+    auto const& values = args[0].array();
+
+    std::vector<std::uint64_t> keys(values.size());
+    for (std::size_t i = 0; i < keys.size(); i++)
+        keys[i] = order_key(values[i]);
+
+    radix_sort(keys.data(), keys.size(), vm.threads());
+
+    auto out = make_array(keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++)
+        (*out)[i] = from_order_key(keys[i]);
+    return out;
+}
+
+Value builtin_median(std::vector<Value> const& args, VirtualMachine&) {
+    return percentiles(args[0].array(), {50}).front();
+}
+
+// percentile(v, 99) or percentile(v, [50, 90, 99])
+Value builtin_percentile(std::vector<Value> const& args, VirtualMachine&) {
+    if (not args[1].is_array())
+        return percentiles(args[0].array(), {args[1].number()}).front();
+
+    return std::make_shared<Value::Array>(
+        percentiles(args[0].array(), args[1].array()));
+}
+
+// window length argument of the mov* builtins
+std::size_t window_length(Value const& value) {
+    double const w = value.number();
+    if (not(w >= 1) or w != std::floor(w))
+        throw std::runtime_error("Window length must be a whole number "
+                                 "of at least 1\n");
+    return w;
+}
+
+// trailing window sums, the first w-1 windows are the ones that fit. the
+// sum is updated as the window slides, with a compensation term so the
+// rounding error of the adds and subtracts doesn't build up over a long
+// series. NaNs and infinities are counted per window instead of added, so
+// they only affect the windows holding them without poisoning the running
+// sum
+std::shared_ptr<Value::Array> moving_sums(Value::Array const& values,
+                                          std::size_t const w,
+                                          bool const average) {
+    std::size_t const n = values.size();
+    auto out = make_array(n);
+
+    double sum = 0, compensation = 0;
+    std::size_t nans = 0, infs = 0, minus_infs = 0;
+    auto add = [&](double const value) {
+        double const t = sum + value;
+        if (std::abs(sum) >= std::abs(value))
+            compensation += (sum - t) + value;
+        else
+            compensation += (value - t) + sum;
+        sum = t;
+    };
+    // adds `value` to the window, or takes it back out with -1
+    auto count = [&](double const value, int const sign) {
+        if (value != value)
+            nans += sign;
+        else if (value == std::numeric_limits<double>::infinity())
+            infs += sign;
+        else if (value == -std::numeric_limits<double>::infinity())
+            minus_infs += sign;
+        else
+            add(sign * value);
+    };
+
+    for (std::size_t i = 0; i < n; i++) {
+        count(values[i], 1);
+        if (i >= w)
+            count(values[i - w], -1);
+
+        double const length = std::min(i + 1, w);
+        double total = sum + compensation;
+        if (nans or (infs and minus_infs))
+            total = std::numeric_limits<double>::quiet_NaN();
+        else if (infs)
+            total = std::numeric_limits<double>::infinity();
+        else if (minus_infs)
+            total = -std::numeric_limits<double>::infinity();
+        (*out)[i] = average ? total / length : total;
+    }
+
+    return out;
+}
+
+// trailing window minimum (or maximum with `Greater`). a monotonic deque
+// of indices, kept in a ring buffer of w slots, holds the candidates: every
+// new value evicts the ones it beats from the back, so each index is pushed
+// and popped once and the front is always the answer
+template <typename Better>
+std::shared_ptr<Value::Array> moving_extremes(Value::Array const& values,
+                                              std::size_t const w,
+                                              Better better) {
+    std::size_t const n = values.size();
+    auto out = make_array(n);
+
+    std::vector<std::size_t> ring(std::min(w, n) + 1);
+    std::size_t head = 0, size = 0, nans = 0;
+    auto at = [&](std::size_t const pos) -> std::size_t& {
+        return ring[(head + pos) % ring.size()];
+    };
+
+    for (std::size_t i = 0; i < n; i++) {
+        if (i >= w and values[i - w] != values[i - w])
+            nans -= 1;
+
+        // drop the candidate that slid out of the window
+        if (size > 0 and at(0) + w <= i) {
+            head = (head + 1) % ring.size();
+            size -= 1;
+        }
+
+        if (values[i] == values[i]) {
+            while (size > 0 and not better(values[at(size - 1)], values[i]))
+                size -= 1;
+            at(size) = i;
+            size += 1;
+        } else {
+            nans += 1;
+        }
+
+        (*out)[i] = nans or size == 0 ? std::numeric_limits<double>::quiet_NaN()
+                                      : values[at(0)];
+    }
+
+    return out;
+}
+
+Value builtin_movsum(std::vector<Value> const& args, VirtualMachine&) {
+    return moving_sums(args[0].array(), window_length(args[1]), false);
+}
+
+Value builtin_movavg(std::vector<Value> const& args, VirtualMachine&) {
+    return moving_sums(args[0].array(), window_length(args[1]), true);
+}
+
+Value builtin_movmin(std::vector<Value> const& args, VirtualMachine&) {
+    return moving_extremes(args[0].array(), window_length(args[1]),
+                           std::less<double>());
+}
+
+Value builtin_movmax(std::vector<Value> const& args, VirtualMachine&) {
+    return moving_extremes(args[0].array(), window_length(args[1]),
+                           std::greater<double>());
+}
+
+// s[0] = v[0], s[i] = alpha * v[i] + (1 - alpha) * s[i - 1]
+Value builtin_ewma(std::vector<Value> const& args, VirtualMachine&) {
+    auto const& values = args[0].array();
+    double const alpha = args[1].number();
+    if (not(alpha > 0 and alpha <= 1))
+        throw std::runtime_error("ewma() needs 0 < alpha <= 1\n");
+
+    auto out = make_array(values.size());
+    double state = values.empty() ? 0 : values.front();
+    for (std::size_t i = 0; i < values.size(); i++) {
+        state += alpha * (values[i] - state);
+        (*out)[i] = state;
+    }
+
+    return out;
+}
+
+// differences of neighbours, one shorter than the input
+Value builtin_diff(std::vector<Value> const& args, VirtualMachine&) {
+    auto const& values = args[0].array();
+    auto out = make_array(values.empty() ? 0 : values.size() - 1);
+
+    double const* const in = values.data();
+    double* const dst = out->data();
+    for (std::size_t i = 0; i < out->size(); i++)
+        dst[i] = in[i + 1] - in[i];
+
+    return out;
+}
+
+// associative operations for the scans. the packed versions combine lanes
+// the same way the scalar ones do
+struct ScanAdd {
+    static constexpr double identity = 0;
+    static double apply(double const a, double const b) { return a + b; }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d const a, __m128d const b) {
+        return _mm_add_pd(a, b);
+    }
+#endif
+};
+
+struct ScanMultiply {
+    static constexpr double identity = 1;
+    static double apply(double const a, double const b) { return a * b; }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d const a, __m128d const b) {
+        return _mm_mul_pd(a, b);
+    }
+#endif
+};
+
+// min and max let a NaN through once it's in either operand, so it stays in
+// the carry for the rest of the scan, like cumsum and movmax. the scalar
+// comparison and minpd/maxpd alone would both hand back the second operand
+// and drop it
+struct ScanMin {
+    static constexpr double identity = std::numeric_limits<double>::infinity();
+    static double apply(double const a, double const b) {
+        return a < b or a != a ? a : b;
+    }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d const a, __m128d const b) {
+        // or-ing a NaN into any value leaves a NaN
+        return _mm_or_pd(_mm_min_pd(a, b),
+                         _mm_and_pd(_mm_cmpunord_pd(a, a), a));
+    }
+#endif
+};
+
+struct ScanMax {
+    static constexpr double identity = -std::numeric_limits<double>::infinity();
+    static double apply(double const a, double const b) {
+        return a > b or a != a ? a : b;
+    }
+#if defined(__SSE2__)
+    static __m128d apply(__m128d const a, __m128d const b) {
+        return _mm_or_pd(_mm_max_pd(a, b),
+                         _mm_and_pd(_mm_cmpunord_pd(a, a), a));
+    }
+#endif
+};
+
+// inclusive scan of in[0..n) into out, starting from `carry`. pairs of
+// values are scanned inside a register (shift one lane over, combine) and
+// the running carry is then folded into both lanes at once, which halves
+// the length of the dependency chain
+template <typename Op>
+void scan_block(double const* in,
+                double* out,
+                std::size_t const n,
+                double carry) {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    __m128d packed_carry = _mm_set1_pd(carry);
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(in + i);
+        x = Op::apply(x, _mm_unpacklo_pd(_mm_set1_pd(Op::identity), x));
+        x = Op::apply(packed_carry, x);
+        _mm_storeu_pd(out + i, x);
+        packed_carry = _mm_unpackhi_pd(x, x);
+    }
+    carry = _mm_cvtsd_f64(packed_carry);
+#endif
+    for (; i < n; i++) {
+        carry = Op::apply(carry, in[i]);
+        out[i] = carry;
+    }
+}
+
+template <typename Op>
+double reduce_block(double const* in, std::size_t const n) {
+    double acc[4] = {Op::identity, Op::identity, Op::identity, Op::identity};
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (unsigned lane = 0; lane < 4; lane++)
+            acc[lane] = Op::apply(acc[lane], in[i + lane]);
+    }
+    for (; i < n; i++)
+        acc[0] = Op::apply(acc[0], in[i]);
+
+    return Op::apply(Op::apply(acc[0], acc[1]), Op::apply(acc[2], acc[3]));
+}
+
+// below this many values a scan isn't worth splitting across threads
+constexpr std::size_t kParallelScanMin = std::size_t(1) << 16;
+
+// inclusive scan. big inputs get one block per thread: the first pass
+// reduces every block to its total, the totals are scanned into each
+// block's carry, and the second pass scans all blocks from their carries
+// independently
+template <typename Op>
+std::shared_ptr<Value::Array> parallel_scan(Value::Array const& values,
+                                            unsigned threads) {
+    std::size_t const n = values.size();
+    auto out = make_array(n);
+    double const* const in = values.data();
+    double* const dst = out->data();
+
+    threads = n < kParallelScanMin ? 1 : threads;
+    if (threads == 1) {
+        scan_block<Op>(in, dst, n, Op::identity);
+        return out;
+    }
+
+    std::size_t const block = (n + threads - 1) / threads;
+    std::vector<double> carries(threads);
+
+    run_chunks(threads, threads, [&](std::size_t b, unsigned) {
+        std::size_t const begin = std::min(n, b * block);
+        carries[b] =
+            reduce_block<Op>(in + begin, std::min(n, begin + block) - begin);
+    });
+
+    double carry = Op::identity;
+    for (auto& block_carry : carries) {
+        double const total = block_carry;
+        block_carry = carry;
+        carry = Op::apply(carry, total);
+    }
+
+    run_chunks(threads, threads, [&](std::size_t b, unsigned) {
+        std::size_t const begin = std::min(n, b * block);
+        scan_block<Op>(in + begin, dst + begin,
+                       std::min(n, begin + block) - begin, carries[b]);
+    });
+
+    return out;
+}
+
+// a sum with its running rounding error (Neumaier)
+struct CompensatedSum {
+    double sum = 0, compensation = 0;
+
+    void add(double const value) {
+        double const t = sum + value;
+        if (std::abs(sum) >= std::abs(value))
+            compensation += (sum - t) + value;
+        else
+            compensation += (value - t) + sum;
+        sum = t;
+    }
+
+    double total() const noexcept { return sum + compensation; }
+};
+
+// cumsum(v, 1): the same two passes, but every block carries its rounding
+// error along instead of dropping it
+std::shared_ptr<Value::Array> compensated_cumsum(Value::Array const& values,
+                                                 unsigned threads) {
+    std::size_t const n = values.size();
+    auto out = make_array(n);
+    double const* const in = values.data();
+    double* const dst = out->data();
+
+    threads = n < kParallelScanMin ? 1 : threads;
+    std::size_t const block = (n + threads - 1) / threads;
+    std::vector<CompensatedSum> carries(threads);
+
+    if (threads > 1) {
+        run_chunks(threads, threads, [&](std::size_t b, unsigned) {
+            std::size_t const begin = std::min(n, b * block);
+            for (std::size_t i = begin; i < std::min(n, begin + block); i++)
+                carries[b].add(in[i]);
+        });
+
+        CompensatedSum carry;
+        for (auto& block_carry : carries) {
+            CompensatedSum const total = block_carry;
+            block_carry = carry;
+            carry.add(total.sum);
+            carry.add(total.compensation);
+        }
+    }
+
+    run_chunks(threads, threads, [&](std::size_t b, unsigned) {
+        CompensatedSum sum = carries[b];
+        std::size_t const begin = std::min(n, b * block);
+        for (std::size_t i = begin; i < std::min(n, begin + block); i++) {
+            sum.add(in[i]);
+            dst[i] = sum.total();
+        }
+    });
+
+    return out;
+}
+
+Value builtin_cumsum(std::vector<Value> const& args, VirtualMachine& vm) {
+    if (args.size() == 2 and args[1].number() != 0)
+        return compensated_cumsum(args[0].array(), vm.threads());
+    return parallel_scan<ScanAdd>(args[0].array(), vm.threads());
+}
+
+Value builtin_cumprod(std::vector<Value> const& args, VirtualMachine& vm) {
+    return parallel_scan<ScanMultiply>(args[0].array(), vm.threads());
+}
+
+Value builtin_cummax(std::vector<Value> const& args, VirtualMachine& vm) {
+    return parallel_scan<ScanMax>(args[0].array(), vm.threads());
+}
+
+// below this many multiply-adds a linear algebra kernel stays on one thread
+constexpr std::size_t kParallelLinalgMin = std::size_t(1) << 18;
+
+// eight independent accumulators, so the adds don't wait on each other and
+// the compiler can keep them in vector registers
+ISA_INLINE double dot_kernel_body(double const* const a,
+                         double const* const b,
+                         std::size_t const n) {
+    double acc[8] = {};
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (unsigned j = 0; j < 8; j++)
+            acc[j] += a[i + j] * b[i + j];
+    }
+    for (; i < n; i++)
+        acc[i % 8] += a[i] * b[i];
+
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+           ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+ISA_DISPATCH(,
+             double,
+             dot_kernel,
+             (double const* const a, double const* const b, std::size_t n),
+             (a, b, n))
+
+// one block per thread, partial sums added back in block order so the
+// result doesn't depend on scheduling
+double dot_product(double const* const a,
+                   double const* const b,
+                   std::size_t const n,
+                   unsigned threads) {
+    threads = n < kParallelLinalgMin ? 1 : threads;
+    if (threads == 1)
+        return dot_kernel(a, b, n);
+
+    std::size_t const block = (n + threads - 1) / threads;
+    std::vector<double> partial(threads);
+    run_chunks(threads, threads, [&](std::size_t b_idx, unsigned) {
+        std::size_t const begin = std::min(n, b_idx * block);
+        std::size_t const end = std::min(n, begin + block);
+        partial[b_idx] = dot_kernel(a + begin, b + begin, end - begin);
+    });
+
+    double sum = 0;
+    for (double const value : partial)
+        sum += value;
+    return sum;
+}
+
+// y = M x for rows [begin, end). four rows share every load of x, and give
+// four independent accumulator chains
+ISA_INLINE void matvec_rows_body(double const* const m,
+                 double const* const x,
+                 double* const y,
+                 std::size_t const cols,
+                 std::size_t begin,
+                 std::size_t const end) {
+    for (; begin + 4 <= end; begin += 4) {
+        double const* const r0 = m + begin * cols;
+        double const* const r1 = r0 + cols;
+        double const* const r2 = r1 + cols;
+        double const* const r3 = r2 + cols;
+        double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (std::size_t k = 0; k < cols; k++) {
+            double const xk = x[k];
+            s0 += r0[k] * xk;
+            s1 += r1[k] * xk;
+            s2 += r2[k] * xk;
+            s3 += r3[k] * xk;
+        }
+        y[begin] = s0;
+        y[begin + 1] = s1;
+        y[begin + 2] = s2;
+        y[begin + 3] = s3;
+    }
+    for (; begin < end; begin++)
+        y[begin] = dot_kernel_body(m + begin * cols, x, cols);
+}
+
+ISA_DISPATCH(,
+             void,
+             matvec_rows,
+             (double const* const m,
+              double const* const x,
+              double* const y,
+              std::size_t const cols,
+              std::size_t const begin,
+              std::size_t const end),
+             (m, x, y, cols, begin, end))
+
+// matmul tiling: a KC x NC panel of B stays in L2 while every row strip of
+// A streams past it, and the 4x4 block of C being built lives in registers
+constexpr std::size_t kMatmulKC = 256;
+constexpr std::size_t kMatmulNC = 512;
+constexpr std::size_t kMatmulMC = 64;
+constexpr std::size_t kMicro = 4;
+
+// c[4][ldc] += a (kc x 4, interleaved) * b (kc x 4, interleaved), only the
+// top-left rows x cols of it written back
+ISA_INLINE void matmul_micro(double const* a,
+                             double const* b,
+                             std::size_t const kc,
+                             double* const c,
+                             std::size_t const ldc,
+                             std::size_t const rows,
+                             std::size_t const cols) {
+    double acc[kMicro][kMicro] = {};
+    for (std::size_t p = 0; p < kc; p++, a += kMicro, b += kMicro) {
+        for (unsigned r = 0; r < kMicro; r++) {
+            for (unsigned j = 0; j < kMicro; j++)
+                acc[r][j] += a[r] * b[j];
+        }
+    }
+
+    for (std::size_t r = 0; r < rows; r++) {
+        for (std::size_t j = 0; j < cols; j++)
+            c[r * ldc + j] += acc[r][j];
+    }
+}
+
+// every micro tile of a packed mc x kc strip of a against a packed kc x nc
+// panel of b
+ISA_INLINE void matmul_block_body(double const* const pa,
+                                  double const* const pb,
+                                  std::size_t const kc,
+                                  double* const c,
+                                  std::size_t const ldc,
+                                  std::size_t const mc,
+                                  std::size_t const nc) {
+    for (std::size_t j = 0; j < nc; j += kMicro) {
+        for (std::size_t i = 0; i < mc; i += kMicro) {
+            matmul_micro(pa + i * kc, pb + j * kc, kc, c + i * ldc + j, ldc,
+                         std::min(kMicro, mc - i), std::min(kMicro, nc - j));
+        }
+    }
+}
+
+ISA_DISPATCH(,
+             void,
+             matmul_block,
+             (double const* const pa,
+              double const* const pb,
+              std::size_t const kc,
+              double* const c,
+              std::size_t const ldc,
+              std::size_t const mc,
+              std::size_t const nc),
+             (pa, pb, kc, c, ldc, mc, nc))
+
+// c (m x n) = a (m x k) * b (k x n), all row-major. panels are packed into
+// zero-padded strips of four so the micro kernel never needs edge cases
+void matmul(double const* const a,
+            double const* const b,
+            double* const c,
+            std::size_t const m,
+            std::size_t const k,
+            std::size_t const n,
+            unsigned threads) {
+    std::fill_n(c, m * n, 0.0);
+    threads = m * n * k < kParallelLinalgMin ? 1 : threads;
+
+    std::size_t const row_blocks = (m + kMatmulMC - 1) / kMatmulMC;
+    std::vector<double> packed_b(kMatmulKC * kMatmulNC);
+    std::vector<std::vector<double>> packed_a(
+        threads, std::vector<double>(kMatmulKC * kMatmulMC));
+
+    for (std::size_t jc = 0; jc < n; jc += kMatmulNC) {
+        std::size_t const nc = std::min(kMatmulNC, n - jc);
+        for (std::size_t pc = 0; pc < k; pc += kMatmulKC) {
+            std::size_t const kc = std::min(kMatmulKC, k - pc);
+
+            // b[pc.., jc..] as strips of four columns, row by row
+            for (std::size_t j = 0; j < nc; j += kMicro) {
+                double* strip = packed_b.data() + j * kc;
+                for (std::size_t p = 0; p < kc; p++, strip += kMicro) {
+                    double const* const row = b + (pc + p) * n + jc + j;
+                    for (std::size_t jj = 0; jj < kMicro; jj++)
+                        strip[jj] = j + jj < nc ? row[jj] : 0;
+                }
+            }
+
+            auto row_block = [&](std::size_t const block, unsigned worker) {
+                std::size_t const ic = block * kMatmulMC;
+                std::size_t const mc = std::min(kMatmulMC, m - ic);
+                double* const pa = packed_a[worker].data();
+
+                // a[ic.., pc..] as strips of four rows, column by column
+                for (std::size_t i = 0; i < mc; i += kMicro) {
+                    double* strip = pa + i * kc;
+                    for (std::size_t p = 0; p < kc; p++, strip += kMicro) {
+                        for (std::size_t ii = 0; ii < kMicro; ii++) {
+                            strip[ii] = i + ii < mc
+                                            ? a[(ic + i + ii) * k + pc + p]
+                                            : 0;
+                        }
+                    }
+                }
+
+                matmul_block(pa, packed_b.data(), kc, c + ic * n + jc, n, mc,
+                             nc);
+            };
+
+            if (threads == 1) {
+                for (std::size_t block = 0; block < row_blocks; block++)
+                    row_block(block, 0);
+            } else {
+                run_chunks(row_blocks, threads, row_block);
+            }
+        }
+    }
+}
+
+Value builtin_matrix(std::vector<Value> const& args, VirtualMachine&) {
+    auto const& values = args[0].array();
+    double const cols = args[1].number();
+    if (not(cols >= 1) or cols != std::floor(cols) or
+        values.size() % std::size_t(cols) != 0)
+        throw std::runtime_error("Column count doesn't divide the array\n");
+    return Value(args[0].shared_array(), cols);
+}
+
+Value builtin_transpose(std::vector<Value> const& args, VirtualMachine&) {
+    auto const& values = args[0].array();
+    // a plain array is taken as a single column
+    std::size_t const cols = args[0].is_matrix() ? args[0].cols() : 1;
+    std::size_t const rows = values.size() / cols;
+
+    auto out = make_array(values.size());
+    for (std::size_t i = 0; i < rows; i++) {
+        for (std::size_t j = 0; j < cols; j++)
+            (*out)[j * rows + i] = values[i * cols + j];
+    }
+    return Value(std::move(out), rows);
+}
+
+Value builtin_dot(std::vector<Value> const& args, VirtualMachine& vm) {
+    auto const& a = args[0].array();
+    auto const& b = args[1].array();
+    if (a.size() != b.size())
+        throw std::runtime_error("Array lengths differ\n");
+    return dot_product(a.data(), b.data(), a.size(), vm.threads());
+}
+
+Value builtin_norm(std::vector<Value> const& args, VirtualMachine& vm) {
+    auto const& v = args[0].array();
+    return std::sqrt(dot_product(v.data(), v.data(), v.size(), vm.threads()));
+}
+
+Value builtin_matvec(std::vector<Value> const& args, VirtualMachine& vm) {
+    if (not args[0].is_matrix() or args[1].is_matrix())
+        throw std::runtime_error("matvec expects a matrix and an array\n");
+    std::size_t const rows = args[0].rows(), cols = args[0].cols();
+    auto const& x = args[1].array();
+    if (x.size() != cols)
+        throw std::runtime_error("Matrix and array sizes differ\n");
+
+    double const* const m = args[0].array().data();
+    auto out = make_array(rows);
+    unsigned const threads =
+        rows * cols < kParallelLinalgMin ? 1 : vm.threads();
+    if (threads == 1) {
+        matvec_rows(m, x.data(), out->data(), cols, 0, rows);
+        return out;
+    }
+
+    // row blocks of a multiple of four, a few per thread
+    std::size_t const block =
+        ((rows + 4 * threads - 1) / (4 * threads) + 3) & ~std::size_t(3);
+    run_chunks((rows + block - 1) / block, threads,
+               [&](std::size_t b_idx, unsigned) {
+                   std::size_t const begin = b_idx * block;
+                   matvec_rows(m, x.data(), out->data(), cols, begin,
+                               std::min(rows, begin + block));
+               });
+    return out;
+}
+
+Value builtin_matmul(std::vector<Value> const& args, VirtualMachine& vm) {
+    if (not args[0].is_matrix() or not args[1].is_matrix())
+        throw std::runtime_error("matmul expects two matrices\n");
+    std::size_t const m = args[0].rows(), k = args[0].cols();
+    std::size_t const n = args[1].cols();
+    if (args[1].rows() != k)
+        throw std::runtime_error("Matrix sizes don't match\n");
+
+    auto out = make_array(m * n);
+    matmul(args[0].array().data(), args[1].array().data(), out->data(), m, k,
+           n, vm.threads());
+    return Value(std::move(out), n);
+}
+
+Builtin const kBuiltins[] = {
+    {"len", 1, 1, builtin_len},
+    {"range", 1, 2, builtin_range},
+    {"sort", 1, 1, builtin_sort},
+    {"median", 1, 1, builtin_median},
+    {"percentile", 2, 2, builtin_percentile},
+    {"movsum", 2, 2, builtin_movsum},
+    {"movavg", 2, 2, builtin_movavg},
+    {"movmin", 2, 2, builtin_movmin},
+    {"movmax", 2, 2, builtin_movmax},
+    {"ewma", 2, 2, builtin_ewma},
+    {"diff", 1, 1, builtin_diff},
+    {"cumsum", 1, 2, builtin_cumsum},
+    {"cumprod", 1, 1, builtin_cumprod},
+    {"cummax", 1, 1, builtin_cummax},
+    {"matrix", 2, 2, builtin_matrix},
+    {"transpose", 1, 1, builtin_transpose},
+    {"dot", 2, 2, builtin_dot},
+    {"norm", 1, 1, builtin_norm},
+    {"matvec", 2, 2, builtin_matvec},
+    {"matmul", 2, 2, builtin_matmul},
+};
+
+Builtin const* find_builtin(std::string const& name) {
+    for (auto const& builtin : kBuiltins) {
+        if (name == builtin.name)
+            return &builtin;
+    }
+
+    return nullptr;
+}
+
+// the scalar part of an expression flattened into stack code, so it can
+// run on any number type (see BasicVirtualMachine::run)
+struct Instruction {
+    enum Op : std::uint8_t {
+        // operand indexes Program::literals
+        Push,
+        // operand indexes Program::names
+        Load,
+        Store,
+
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        Negate,
+        Not,
+        // replaces the top of the stack by 1 or 0
+        Truth,
+        PushTrue,
+        PushFalse,
+
+        // operand is the index of the instruction to continue at
+        Jump,
+        // pops the condition
+        JumpIfFalse,
+
+        // replaces the top `operand` values by an array of them, for number
+        // types that have arrays
+        MakeArray,
+    };
+
+    Op op;
+    std::uint32_t operand = 0;
+};
+
+struct Program {
+    std::vector<Instruction> code;
+    // source text of the number literals, parsed by the number type
+    std::vector<std::string> literals;
+    std::vector<std::string> names;
+    // `i` is the imaginary unit instead of a variable
+    bool imaginary = false;
+
+    void emit(Instruction::Op const op, std::uint32_t const operand = 0) {
+        code.push_back(Instruction{.op = op, .operand = operand});
+    }
+
+    std::uint32_t name(std::string const& str) {
+        auto const found = std::find(names.begin(), names.end(), str);
+        if (found != names.end())
+            return found - names.begin();
+        names.push_back(str);
+        return names.size() - 1;
+    }
+
+    // emits a jump with its target still open, for patch() to fill in
+    std::size_t emit_jump(Instruction::Op const op) {
+        emit(op);
+        return code.size() - 1;
+    }
+
+    void patch(std::size_t const jump) { code[jump].operand = code.size(); }
+};
+
+// operations of a number type for BasicVirtualMachine, as static members:
+//
+//     T parse(std::string_view literal)
+//     T add(a, b), subtract(a, b), multiply(a, b), divide(a, b), negate(a)
+//     bool less(a, b), equal(a, b), truthy(a)
+//     T from_bool(bool)
+//     std::string format(a)
+//
+// a type whose comparisons can come out undecided has
+// `T compare(Instruction::Op, a, b)` instead of less and equal, which gives
+// the result of any comparison as a T, and Not and Truth as comparisons
+// with 0
+//
+// every number type specializes it, and that is all it takes to run the
+// repl on it
+template <typename T>
+struct Arithmetic;
+
+template <typename T>
+struct FloatArithmetic {
+    static T parse(std::string_view const literal) {
+        std::string const str(literal);
+        char* end;
+        T value;
+        if constexpr (std::is_same_v<T, float>)
+            value = std::strtof(str.c_str(), &end);
+        else if constexpr (std::is_same_v<T, double>)
+            value = std::strtod(str.c_str(), &end);
+        else
+            value = std::strtold(str.c_str(), &end);
+        if (end != str.c_str() + str.size())
+            throw std::runtime_error("Invalid number \"" + str + "\"\n");
+        return value;
+    }
+
+    static T add(T const a, T const b) { return a + b; }
+    static T subtract(T const a, T const b) { return a - b; }
+    static T multiply(T const a, T const b) { return a * b; }
+    static T divide(T const a, T const b) { return a / b; }
+    static T negate(T const a) { return -a; }
+
+    static bool less(T const a, T const b) { return a < b; }
+    static bool equal(T const a, T const b) { return a == b; }
+    static bool truthy(T const a) { return a != 0; }
+    static T from_bool(bool const b) { return b; }
+
+    // every digit the type holds
+    static std::string format(T const a) {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%.*Lg",
+                      std::numeric_limits<T>::digits10, (long double)a);
+        return buf;
+    }
+};
+
+template <>
+struct Arithmetic<float> : FloatArithmetic<float> {};
+template <>
+struct Arithmetic<double> : FloatArithmetic<double> {};
+template <>
+struct Arithmetic<long double> : FloatArithmetic<long double> {};
+
+// overflow and division by zero are errors rather than undefined
+template <>
+struct Arithmetic<std::int64_t> {
+    using T = std::int64_t;
+
+    static T parse(std::string_view const literal) {
+        T value;
+        auto const [ptr, ec] = std::from_chars(
+            literal.data(), literal.data() + literal.size(), value);
+        if (ec == std::errc::result_out_of_range)
+            overflow();
+        if (ec != std::errc() or ptr != literal.data() + literal.size())
+            throw std::runtime_error("\"" + std::string(literal) +
+                                     "\" isn't an integer\n");
+        return value;
+    }
+
+    [[noreturn]] static void overflow() {
+        throw std::runtime_error("Integer overflow\n");
+    }
+
+    static T add(T const a, T const b) {
+        T out;
+        if (__builtin_add_overflow(a, b, &out))
+            overflow();
+        return out;
+    }
+    static T subtract(T const a, T const b) {
+        T out;
+        if (__builtin_sub_overflow(a, b, &out))
+            overflow();
+        return out;
+    }
+    static T multiply(T const a, T const b) {
+        T out;
+        if (__builtin_mul_overflow(a, b, &out))
+            overflow();
+        return out;
+    }
+    // truncates towards zero
+    static T divide(T const a, T const b) {
+        if (b == 0)
+            throw std::runtime_error("Division by zero\n");
+        if (b == -1 and a == std::numeric_limits<T>::min())
+            overflow();
+        return a / b;
+    }
+    static T negate(T const a) { return subtract(0, a); }
+
+    static bool less(T const a, T const b) { return a < b; }
+    static bool equal(T const a, T const b) { return a == b; }
+    static bool truthy(T const a) { return a != 0; }
+    static T from_bool(bool const b) { return b; }
+
+    static std::string format(T const a) { return std::to_string(a); }
+};
+
+// whether Arithmetic<T> has compare()
+template <typename T, typename = void>
+struct HasCompare : std::false_type {};
+template <typename T>
+struct HasCompare<T,
+                  std::void_t<decltype(Arithmetic<T>::compare(
+                      Instruction::Less, std::declval<T const&>(),
+                      std::declval<T const&>()))>> : std::true_type {};
+
+// a comparison instruction through the operations of T
+template <typename T>
+T apply_comparison(Instruction::Op const op, T const& a, T const& b) {
+    using Ops = Arithmetic<T>;
+    if constexpr (HasCompare<T>::value) {
+        return Ops::compare(op, a, b);
+    } else {
+        switch (op) {
+            case Instruction::Less:
+                return Ops::from_bool(Ops::less(a, b));
+            case Instruction::LessEqual:
+                return Ops::from_bool(Ops::less(a, b) or Ops::equal(a, b));
+            case Instruction::Greater:
+                return Ops::from_bool(Ops::less(b, a));
+            case Instruction::GreaterEqual:
+                return Ops::from_bool(Ops::less(b, a) or Ops::equal(a, b));
+            case Instruction::Equal:
+                return Ops::from_bool(Ops::equal(a, b));
+            case Instruction::NotEqual:
+                return Ops::from_bool(not Ops::equal(a, b));
+            default:
+                throw std::runtime_error("Bad instruction\n");
+        }
+    }
+}
+
+// a binary instruction through the operations of T. BinaryNode takes its
+// scalar results from here too, so every operator has one definition
+template <typename T>
+T apply_binary(Instruction::Op const op, T const& a, T const& b) {
+    using Ops = Arithmetic<T>;
+    switch (op) {
+        case Instruction::Add:
+            return Ops::add(a, b);
+        case Instruction::Subtract:
+            return Ops::subtract(a, b);
+        case Instruction::Multiply:
+            return Ops::multiply(a, b);
+        case Instruction::Divide:
+            return Ops::divide(a, b);
+        default:
+            return apply_comparison(op, a, b);
+    }
+}
+
+// Negate, Not or Truth
+template <typename T>
+T apply_unary(Instruction::Op const op, T const& a) {
+    using Ops = Arithmetic<T>;
+    switch (op) {
+        case Instruction::Negate:
+            return Ops::negate(a);
+        case Instruction::Not:
+            if constexpr (HasCompare<T>::value)
+                return Ops::compare(Instruction::Equal, a, Ops::from_bool(false));
+            else
+                return Ops::from_bool(not Ops::truthy(a));
+        case Instruction::Truth:
+            if constexpr (HasCompare<T>::value)
+                return Ops::compare(Instruction::NotEqual, a,
+                                    Ops::from_bool(false));
+            else
+                return Ops::from_bool(Ops::truthy(a));
+        default:
+            throw std::runtime_error("Bad instruction\n");
+    }
+}
+
+// a closed range [lo, hi] of doubles guaranteed to hold the exact result.
+// each bound is computed in the default rounding and then, using the
+// exact error of that operation, moved one step outwards only when it
+// landed on the wrong side. exact results stay exact and no rounding mode
+// is ever switched
+struct Interval {
+    double lo = 0;
+    double hi = 0;
+
+    Interval() = default;
+    explicit Interval(double const point) : lo(point), hi(point) {}
+    Interval(double const lo, double const hi) : lo(lo), hi(hi) {}
+
+    // below this products and quotients may lose bits to underflow, so
+    // their error terms aren't exact any more
+    static constexpr double kExactLimit = 0x1p-969;
+
+    static double down(double const r) {
+        return std::nextafter(r, -std::numeric_limits<double>::infinity());
+    }
+    static double up(double const r) {
+        return std::nextafter(r, std::numeric_limits<double>::infinity());
+    }
+
+    // bounds for a rounded result r of exact value r + err. a nan error
+    // means it isn't known, and both sides are widened
+    static double below(double const r, double const err) {
+        return err < 0 or std::isnan(err) ? down(r) : r;
+    }
+    static double above(double const r, double const err) {
+        return err > 0 or std::isnan(err) ? up(r) : r;
+    }
+
+    // error of a + b, exactly (two-sum)
+    static double sum_error(double const a, double const b, double const r) {
+        double const bb = r - a;
+        return (a - (r - bb)) + (b - bb);
+    }
+
+    static double product_error(double const a, double const b,
+                                double const r) {
+        if (std::abs(r) < kExactLimit and r != 0)
+            return std::numeric_limits<double>::quiet_NaN();
+        return std::fma(a, b, -r);
+    }
+
+    // only the sign of the error of a / b matters: a - q * b is exact
+    static double quotient_error(double const a, double const b,
+                                 double const q) {
+        if (std::abs(a) < kExactLimit and a != 0)
+            return std::numeric_limits<double>::quiet_NaN();
+        double const rem = std::fma(-q, b, a);
+        return b < 0 ? -rem : rem;
+    }
+
+    // the tightest doubles around a decimal literal, exact when it is
+    // representable
+    static Interval parse(std::string_view literal);
+
+    // inf - inf and the like, and empty fields of a column
+    bool is_nan() const noexcept { return lo != lo or hi != hi; }
+
+    // the doubles around an integer, a point below 2^53
+    static Interval enclose(std::int64_t const value) {
+        double const r = double(value);
+        if (r >= 0x1p63 or std::int64_t(r) > value)
+            return {down(r), r};
+        if (std::int64_t(r) < value)
+            return {r, up(r)};
+        return Interval(r);
+    }
+
+    friend Interval operator+(Interval const& a, Interval const& b) {
+        double const lo = a.lo + b.lo, hi = a.hi + b.hi;
+        return {below(lo, sum_error(a.lo, b.lo, lo)),
+                above(hi, sum_error(a.hi, b.hi, hi))};
+    }
+
+    Interval operator-() const { return {-hi, -lo}; }
+
+    friend Interval operator-(Interval const& a, Interval const& b) {
+        return a + -b;
+    }
+
+    // the extremes are among the four corner products. 0 * inf counts as 0
+    friend Interval operator*(Interval const& a, Interval const& b) {
+        if (a.is_nan() or b.is_nan())
+            return Interval(std::numeric_limits<double>::quiet_NaN());
+        Interval out = {std::numeric_limits<double>::infinity(),
+                        -std::numeric_limits<double>::infinity()};
+        for (double const x : {a.lo, a.hi}) {
+            for (double const y : {b.lo, b.hi}) {
+                double const r = x == 0 or y == 0 ? 0 : x * y;
+                double const err = r == 0 ? 0 : product_error(x, y, r);
+                out.lo = std::min(out.lo, below(r, err));
+                out.hi = std::max(out.hi, above(r, err));
+            }
+        }
+        return out;
+    }
+
+    // a divisor that holds zero can give anything. column blocks compute
+    // both sides of a condition for every row, so this can't be an error
+    friend Interval operator/(Interval const& a, Interval const& b) {
+        if (a.is_nan() or b.is_nan())
+            return Interval(std::numeric_limits<double>::quiet_NaN());
+        if (b.lo <= 0 and b.hi >= 0)
+            return {-std::numeric_limits<double>::infinity(),
+                    std::numeric_limits<double>::infinity()};
+
+        Interval out = {std::numeric_limits<double>::infinity(),
+                        -std::numeric_limits<double>::infinity()};
+        for (double const x : {a.lo, a.hi}) {
+            for (double const y : {b.lo, b.hi}) {
+                double const q = x / y;
+                double const err = std::isinf(y) ? 0 : quotient_error(x, y, q);
+                out.lo = std::min(out.lo, below(q, err));
+                out.hi = std::max(out.hi, above(q, err));
+            }
+        }
+        return out;
+    }
+};
+
+template <>
+struct Arithmetic<Interval> {
+    using T = Interval;
+
+    static T parse(std::string_view const literal) {
+        return Interval::parse(literal);
+    }
+
+    static T add(T const& a, T const& b) { return a + b; }
+    static T subtract(T const& a, T const& b) { return a - b; }
+    static T multiply(T const& a, T const& b) { return a * b; }
+    static T divide(T const& a, T const& b) { return a / b; }
+    static T negate(T const& a) { return -a; }
+
+    // 1 when the comparison holds for every pair of values in the ranges, 0
+    // when it holds for none, and [0, 1] when it depends on which
+    static T compare(Instruction::Op const op, T const& a, T const& b) {
+        auto const decided = [](bool const always, bool const never) {
+            return always ? T{1, 1} : never ? T{0, 0} : T{0, 1};
+        };
+        // nan compares like it does in double, unequal to everything
+        if (a.is_nan() or b.is_nan())
+            return from_bool(op == Instruction::NotEqual);
+        bool const a_point = a.lo == a.hi, b_point = b.lo == b.hi;
+        bool const disjoint = a.hi < b.lo or b.hi < a.lo;
+        switch (op) {
+            case Instruction::Less:
+                return decided(a.hi < b.lo, a.lo >= b.hi);
+            case Instruction::LessEqual:
+                return decided(a.hi <= b.lo, a.lo > b.hi);
+            case Instruction::Greater:
+                return compare(Instruction::Less, b, a);
+            case Instruction::GreaterEqual:
+                return compare(Instruction::LessEqual, b, a);
+            case Instruction::Equal:
+                return decided(a_point and b_point and a.lo == b.lo, disjoint);
+            case Instruction::NotEqual:
+                return decided(disjoint, a_point and b_point and a.lo == b.lo);
+            default:
+                throw std::runtime_error("Bad instruction\n");
+        }
+    }
+
+    // a condition has to go the same way for every value in the range. nan
+    // is true, as in double
+    static bool truthy(T const& a) {
+        if (a.lo > 0 or a.hi < 0 or a.is_nan())
+            return true;
+        if (a.lo == 0 and a.hi == 0)
+            return false;
+        throw std::runtime_error("The condition " + format(a) +
+                                 " may or may not be 0\n");
+    }
+    static T from_bool(bool const b) { return {double(b), double(b)}; }
+
+    // shortest round-tripping digits, a point as a single number
+    static std::string format(T const& a) {
+        auto const shortest = [](double const x) {
+            char buf[32];
+            auto const end = std::to_chars(buf, buf + sizeof buf, x).ptr;
+            return std::string(buf, end);
+        };
+        if (a.lo == a.hi)
+            return shortest(a.lo);
+        return "[" + shortest(a.lo) + ", " + shortest(a.hi) + "]";
+    }
+};
+
+// recycles memory blocks per power of two size class and per thread. syntax
+// trees and big number limbs keep being made and dropped in the same few
+// sizes, and this way only the first of each goes to malloc
+class BlockArena {
+    static constexpr unsigned kClasses = 40;
+    static constexpr std::size_t kKeep = 256;
+
+    std::vector<void*> m_free[kClasses];
+    // bytes of the blocks handed out and not given back, and of those
+    // waiting in the free lists
+    std::size_t m_in_use = 0;
+    std::size_t m_cached = 0;
+
+   public:
+    BlockArena() = default;
+    BlockArena(BlockArena const&) = delete;
+    BlockArena& operator=(BlockArena const&) = delete;
+
+    ~BlockArena() {
+        for (auto& list : m_free) {
+            for (void* block : list)
+                ::operator delete(block);
+        }
+    }
+
+    static BlockArena& local() {
+        thread_local BlockArena arena;
+        return arena;
+    }
+
+    // blocks of at least 16 bytes, rounded up to a power of two
+    static unsigned size_class(std::size_t const bytes) noexcept {
+        return bytes <= 16 ? 4 : 64 - __builtin_clzll(bytes - 1);
+    }
+
+    void* allocate(std::size_t const bytes) {
+        unsigned const cls = size_class(bytes);
+        m_in_use += std::size_t(1) << cls;
+        if (cls < kClasses and not m_free[cls].empty()) {
+            void* const block = m_free[cls].back();
+            m_free[cls].pop_back();
+            m_cached -= std::size_t(1) << cls;
+            return block;
+        }
+        return ::operator new(std::size_t(1) << cls);
+    }
+
+    void deallocate(void* const block, std::size_t const bytes) {
+        unsigned const cls = size_class(bytes);
+        m_in_use -= std::size_t(1) << cls;
+        if (cls < kClasses and m_free[cls].size() < kKeep) {
+            m_free[cls].push_back(block);
+            m_cached += std::size_t(1) << cls;
+        } else {
+            ::operator delete(block);
+        }
+    }
+
+    std::size_t in_use() const noexcept { return m_in_use; }
+    std::size_t cached() const noexcept { return m_cached; }
+};
+
+class Node {
+   protected:
+    Node() = default;
+
+   public:
+    // a statement's tree is built and thrown away as a whole, every line
+    static void* operator new(std::size_t const bytes) {
+        if (g_perf.enabled())
+            g_perf.count_node();
+        return BlockArena::local().allocate(bytes);
+    }
+    static void operator delete(void* const block, std::size_t const bytes) {
+        BlockArena::local().deallocate(block, bytes);
+    }
+
+    virtual void execute(VirtualMachine& vm) = 0;
+
+    // resolves identifiers against the columns of a schema. anything that
+    // isn't a column is read from the vm once, here, and treated as a
+    // constant for the whole run
+    virtual void bind(ColumnSchema& schema, VirtualMachine& vm) = 0;
+
+    // evaluates the node for frame.rows rows at once into `out`
+    virtual void execute_block(BlockFrame<double>& frame, double* out) = 0;
+    virtual void execute_block(BlockFrame<float>& frame, float* out) = 0;
+    virtual void execute_block(BlockFrame<Interval>& frame, Interval* out) = 0;
+
+    // rough number of operations needed to evaluate the node, used to
+    // decide whether skipping it is worth a branch
+    virtual unsigned cost() const noexcept = 0;
+
+    // appends the stack code of the node. builtins have none
+    virtual void compile(Program& program) const = 0;
+
+    virtual ~Node() = default;
+};
+
+// implements the execute_block overloads of a node with its
+// `template <typename T> void block(BlockFrame<T>&, T*)`
+#define BLOCK_NODE                                                       \
+    void execute_block(BlockFrame<double>& frame, double* out) override { \
+        block(frame, out);                                               \
+    }                                                                    \
+    void execute_block(BlockFrame<float>& frame, float* out) override {  \
+        block(frame, out);                                               \
+    }                                                                    \
+    void execute_block(BlockFrame<Interval>& frame, Interval* out)       \
+        override {                                                       \
+        block(frame, out);                                               \
+    }
+
+// interval blocks go a row at a time through Arithmetic<Interval>: every
+// bound needs its own rounding, there's nothing to vectorize
+template <typename T>
+constexpr bool kRowwise = std::is_same_v<T, Interval>;
+
+// whether a row of a condition holds. an interval that may or may not be
+// zero is an error, like in the repl
+template <typename T>
+bool row_truthy(T const& value) {
+    if constexpr (kRowwise<T>)
+        return Arithmetic<T>::truthy(value);
+    else
+        return value != 0;
+}
+
+// a mispredicted branch costs about as much as this many cheap nodes.
+// subexpressions below it are evaluated unconditionally and selected
+// without branching, bigger ones are skipped when they aren't needed
+constexpr unsigned kBranchCost = 12;
+
+// picks `a` or `b` by masking their bit patterns, so the choice compiles to
+// plain integer ops rather than a branch the predictor has to guess
+inline double select(bool const cond, double const a, double const b) {
+    std::uint64_t const mask = -std::uint64_t(cond);
+    std::uint64_t a_bits, b_bits;
+    std::memcpy(&a_bits, &a, sizeof(a));
+    std::memcpy(&b_bits, &b, sizeof(b));
+
+    std::uint64_t const bits = (a_bits & mask) | (b_bits & ~mask);
+    double out;
+    std::memcpy(&out, &bits, sizeof(out));
+    return out;
+}
+
+class IdentNode : public Node {
+    std::string m_ident;
+    std::optional<unsigned> m_slot;
+    double m_constant = 0;
+    VariableCache m_cache;
+
+   public:
+    IdentNode(std::string const& ident) : m_ident(ident) {}
+
+    virtual void execute(VirtualMachine& vm) override {
+        vm.push(m_cache.get(vm, m_ident));
+    }
+
+    virtual void bind(ColumnSchema& schema, VirtualMachine& vm) override {
+        m_slot = schema.use(m_ident);
+        if (m_slot)
+            return;
+
+        if (not vm.has(m_ident))
+            throw std::runtime_error("Unknown column \"" + m_ident + "\"\n");
+
+        auto const value = vm.get(m_ident);
+        if (value.is_array())
+            throw std::runtime_error("Array \"" + m_ident +
+                                     "\" can't be used in a column "
+                                     "expression\n");
+        m_constant = value.number();
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>& frame, T* out) {
+        if (m_slot)
+            std::copy_n(frame.columns[*m_slot], frame.rows, out);
+        else
+            std::fill_n(out, frame.rows, T(m_constant));
+    }
+
+    virtual unsigned cost() const noexcept override { return 1; }
+
+    virtual void compile(Program& program) const override {
+        // the unit is a literal, resolved here rather than looked up
+        if (program.imaginary and m_ident == "i") {
+            program.emit(Instruction::Push, program.literals.size());
+            program.literals.push_back(m_ident);
+            return;
+        }
+        program.emit(Instruction::Load, program.name(m_ident));
+    }
+};
+
+class AssignmentNode : public Node {
+    std::string m_name;
+    std::unique_ptr<Node> m_rhs;
+    VariableCache m_cache;
+
+   public:
+    AssignmentNode(std::string const& name, std::unique_ptr<Node>&& rhs)
+        : m_name(name), m_rhs(std::move(rhs)) {}
+
+    std::string const& name() const noexcept { return m_name; }
+
+    virtual void execute(VirtualMachine& vm) override {
+        m_rhs->execute(vm);
+
+        auto value = vm.pop_value();
+        m_cache.get(vm, m_name) = std::move(value);
+    }
+
+    virtual void bind(ColumnSchema& schema, VirtualMachine& vm) override {
+        m_rhs->bind(schema, vm);
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>& frame, T* out) {
+        m_rhs->execute_block(frame, out);
+    }
+
+    virtual unsigned cost() const noexcept override { return m_rhs->cost(); }
+
+    virtual void compile(Program& program) const override {
+        if (program.imaginary and m_name == "i")
+            throw std::runtime_error("i is the imaginary unit\n");
+        m_rhs->compile(program);
+        program.emit(Instruction::Store, program.name(m_name));
+    }
+};
+
+class NumberNode : public Node {
+    // nothing when the literal is out of range for a double
+    std::optional<double> m_number;
+    // as written, for number types that parse it exactly
+    std::string m_literal;
+    // the tightest interval around the literal, once an interval block
+    // needs it
+    std::optional<Interval> m_enclosure;
+
+    double number() const {
+        if (not m_number)
+            throw std::runtime_error("invalid number conversion error");
+        return *m_number;
+    }
+
+   public:
+    NumberNode(std::optional<double> number, std::string literal)
+        : m_number(number), m_literal(std::move(literal)) {}
+
+    virtual void execute(VirtualMachine& vm) override { vm.push(number()); }
+
+    virtual void bind(ColumnSchema&, VirtualMachine&) override { number(); }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>& frame, T* out) {
+        if constexpr (kRowwise<T>) {
+            if (not m_enclosure)
+                m_enclosure = Interval::parse(m_literal);
+            std::fill_n(out, frame.rows, *m_enclosure);
+        } else {
+            std::fill_n(out, frame.rows, T(*m_number));
+        }
+    }
+
+    virtual unsigned cost() const noexcept override { return 1; }
+
+    virtual void compile(Program& program) const override {
+        program.emit(Instruction::Push, program.literals.size());
+        program.literals.push_back(m_literal);
+    }
+};
+
+class BinaryNode : public Node {
+   public:
+    enum Action {
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+
+        // comparisons yield 1 or 0
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+    };
+
+    BinaryNode(Action action,
+               std::unique_ptr<Node>&& left,
+               std::unique_ptr<Node>&& right)
+        : m_action(action),
+          m_left(std::move(left)),
+          m_right(std::move(right)) {}
+
+    void execute(VirtualMachine& vm) override {
+        m_left->execute(vm);
+        m_right->execute(vm);
+
+        if (vm.peek(0).is_array() or vm.peek(1).is_array()) {
+            auto const right = vm.pop_value();
+            auto const left = vm.pop_value();
+
+            std::size_t const length = broadcast_length({&left, &right});
+            std::vector<double> storage;
+            double const* const right_vals = broadcast(right, length, storage);
+
+            auto out = make_array(length);
+            if (left.is_array())
+                std::copy_n(left.array().data(), length, out->data());
+            else
+                std::fill_n(out->data(), length, left.number());
+
+            apply(m_action, out->data(), right_vals, length);
+            vm.push(Value(std::move(out), broadcast_cols({&left, &right})));
+            return;
+        }
+
+        double const right = vm.pop();
+        double const left = vm.pop();
+        vm.push(apply_binary(instruction(), left, right));
+    }
+
+    void bind(ColumnSchema& schema, VirtualMachine& vm) override {
+        m_left->bind(schema, vm);
+        m_right->bind(schema, vm);
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>& frame, T* out) {
+        m_left->execute_block(frame, out);
+
+        T* const right = frame.scratch.acquire();
+        m_right->execute_block(frame, right);
+
+        if constexpr (kRowwise<T>) {
+            for (std::size_t i = 0; i < frame.rows; i++)
+                out[i] = apply_binary(instruction(), out[i], right[i]);
+        } else {
+            apply(m_action, out, right, frame.rows);
+        }
+
+        frame.scratch.release();
+    }
+
+    unsigned cost() const noexcept override {
+        return 1 + m_left->cost() + m_right->cost();
+    }
+
+    void compile(Program& program) const override {
+        m_left->compile(program);
+        m_right->compile(program);
+        program.emit(instruction());
+    }
+
+    // the instructions are listed in the same order as the actions
+    Instruction::Op instruction() const noexcept {
+        static_assert(Instruction::NotEqual - Instruction::Add ==
+                      NotEqual - Add);
+        return Instruction::Op(Instruction::Add + m_action);
+    }
+
+    // out[i] = out[i] <action> right[i], shared by blocks and arrays. the
+    // loops are kept trivial on purpose so the compiler vectorizes them
+    ISA_DISPATCH(template <typename T> static,
+                 void,
+                 apply,
+                 (Action const action,
+                  T* out,
+                  T const* right,
+                  std::size_t const rows),
+                 (action, out, right, rows))
+
+   private:
+    template <typename T>
+    static ISA_INLINE void apply_body(Action const action,
+                                      T* out,
+                                      T const* right,
+                                      std::size_t const rows) {
+        switch (action) {
+            case Add:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] += right[i];
+                break;
+
+            case Subtract:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] -= right[i];
+                break;
+
+            case Multiply:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] *= right[i];
+                break;
+
+            case Divide:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] /= right[i];
+                break;
+
+            // written as selects between constants so they become a packed
+            // compare and a mask
+            case Less:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] = out[i] < right[i] ? T(1) : T(0);
+                break;
+
+            case LessEqual:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] = out[i] <= right[i] ? T(1) : T(0);
+                break;
+
+            case Greater:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] = out[i] > right[i] ? T(1) : T(0);
+                break;
+
+            case GreaterEqual:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] = out[i] >= right[i] ? T(1) : T(0);
+                break;
+
+            case Equal:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] = out[i] == right[i] ? T(1) : T(0);
+                break;
+
+            case NotEqual:
+                for (std::size_t i = 0; i < rows; i++)
+                    out[i] = out[i] != right[i] ? T(1) : T(0);
+                break;
+        }
+    }
+
+    Action m_action;
+    std::unique_ptr<Node> m_left, m_right;
+};
+
+class UnaryNode : public Node {
+   public:
+    enum Action {
+        Negate,
+        Not,
+    };
+
+    UnaryNode(Action action, std::unique_ptr<Node>&& operand)
+        : m_action(action), m_operand(std::move(operand)) {}
+
+    void execute(VirtualMachine& vm) override {
+        m_operand->execute(vm);
+
+        if (vm.peek().is_array()) {
+            auto const operand = vm.pop_value();
+            auto out = make_array(operand.array().size());
+            std::copy_n(operand.array().data(), out->size(), out->data());
+            apply(m_action, out->data(), out->size());
+            vm.push(Value(std::move(out), operand.cols()));
+            return;
+        }
+
+        vm.push(apply_unary(instruction(), vm.pop()));
+    }
+
+    void bind(ColumnSchema& schema, VirtualMachine& vm) override {
+        m_operand->bind(schema, vm);
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>& frame, T* out) {
+        m_operand->execute_block(frame, out);
+        if constexpr (kRowwise<T>) {
+            for (std::size_t i = 0; i < frame.rows; i++)
+                out[i] = apply_unary(instruction(), out[i]);
+        } else {
+            apply(m_action, out, frame.rows);
+        }
+    }
+
+    unsigned cost() const noexcept override { return 1 + m_operand->cost(); }
+
+    void compile(Program& program) const override {
+        m_operand->compile(program);
+        program.emit(instruction());
+    }
+
+    Instruction::Op instruction() const noexcept {
+        return m_action == Negate ? Instruction::Negate : Instruction::Not;
+    }
+
+    ISA_DISPATCH(template <typename T> static,
+                 void,
+                 apply,
+                 (Action const action, T* out, std::size_t const rows),
+                 (action, out, rows))
+
+   private:
+    template <typename T>
+    static ISA_INLINE void apply_body(Action const action,
+                                      T* out,
+                                      std::size_t const rows) {
+        if (action == Negate) {
+            for (std::size_t i = 0; i < rows; i++)
+                out[i] = -out[i];
+        } else {
+            for (std::size_t i = 0; i < rows; i++)
+                out[i] = out[i] == 0 ? T(1) : T(0);
+        }
+    }
+
+    Action m_action;
+    std::unique_ptr<Node> m_operand;
+};
+
+// `and` / `or`. any non-zero value is true, the result is 1 or 0
+class LogicalNode : public Node {
+   public:
+    enum Action {
+        And,
+        Or,
+    };
+
+    LogicalNode(Action action,
+                std::unique_ptr<Node>&& left,
+                std::unique_ptr<Node>&& right)
+        : m_action(action),
+          m_left(std::move(left)),
+          m_right(std::move(right)),
+          m_short_circuit(m_right->cost() > kBranchCost) {}
+
+    void execute(VirtualMachine& vm) override {
+        m_left->execute(vm);
+
+        // arrays go elementwise, every row needs the right side anyway
+        if (vm.peek().is_array()) {
+            m_right->execute(vm);
+            execute_arrays(vm);
+            return;
+        }
+
+        bool const left = Arithmetic<double>::truthy(vm.peek().number());
+
+        // the left side alone decides the result
+        if (m_short_circuit and left == (m_action == Or)) {
+            vm.pop();
+            vm.push(left);
+            return;
+        }
+
+        m_right->execute(vm);
+        if (vm.peek().is_array()) {
+            execute_arrays(vm);
+            return;
+        }
+
+        bool const right = Arithmetic<double>::truthy(vm.pop());
+        vm.pop();
+
+        // bitwise on purpose, both sides are already evaluated
+        vm.push(m_action == And ? left & right : left | right);
+    }
+
+    void bind(ColumnSchema& schema, VirtualMachine& vm) override {
+        m_left->bind(schema, vm);
+        m_right->bind(schema, vm);
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>& frame, T* out) {
+        m_left->execute_block(frame, out);
+        std::size_t const rows = frame.rows;
+
+        // for blocks the right side can only be skipped when every row is
+        // already decided, which is worth checking only when it's expensive
+        if (m_short_circuit) {
+            bool const decided = m_action == Or;
+            std::size_t undecided = 0;
+            for (std::size_t i = 0; i < rows; i++)
+                undecided += row_truthy(out[i]) != decided;
+
+            if (undecided == 0) {
+                std::fill_n(out, rows, T(decided));
+                return;
+            }
+        }
+
+        T* const right = frame.scratch.acquire();
+        m_right->execute_block(frame, right);
+
+        // the left side of an interval row has to be decided, the right
+        // one only where it's needed, as in the repl
+        if constexpr (kRowwise<T>) {
+            for (std::size_t i = 0; i < rows; i++) {
+                bool const left = row_truthy(out[i]);
+                out[i] = left == (m_action == Or)
+                             ? Arithmetic<T>::from_bool(left)
+                             : apply_unary(Instruction::Truth, right[i]);
+            }
+        } else {
+            apply(m_action, out, right, rows);
+        }
+
+        frame.scratch.release();
+    }
+
+    unsigned cost() const noexcept override {
+        return 1 + m_left->cost() + m_right->cost();
+    }
+
+    // the right side only runs when the left one doesn't decide, which
+    // matters for number types where it could fail (1/0 on integers)
+    void compile(Program& program) const override {
+        m_left->compile(program);
+        auto const skip = program.emit_jump(Instruction::JumpIfFalse);
+        if (m_action == And) {
+            m_right->compile(program);
+            program.emit(Instruction::Truth);
+            auto const done = program.emit_jump(Instruction::Jump);
+            program.patch(skip);
+            program.emit(Instruction::PushFalse);
+            program.patch(done);
+        } else {
+            program.emit(Instruction::PushTrue);
+            auto const done = program.emit_jump(Instruction::Jump);
+            program.patch(skip);
+            m_right->compile(program);
+            program.emit(Instruction::Truth);
+            program.patch(done);
+        }
+    }
+
+    ISA_DISPATCH(template <typename T> static,
+                 void,
+                 apply,
+                 (Action const action,
+                  T* out,
+                  T const* right,
+                  std::size_t const rows),
+                 (action, out, right, rows))
+
+   private:
+    template <typename T>
+    static ISA_INLINE void apply_body(Action const action,
+                                      T* out,
+                                      T const* right,
+                                      std::size_t const rows) {
+        if (action == And) {
+            for (std::size_t i = 0; i < rows; i++)
+                out[i] = (out[i] != 0) & (right[i] != 0) ? T(1) : T(0);
+        } else {
+            for (std::size_t i = 0; i < rows; i++)
+                out[i] = (out[i] != 0) | (right[i] != 0) ? T(1) : T(0);
+        }
+    }
+
+    // both operands are on the stack, at least one of them an array
+    void execute_arrays(VirtualMachine& vm) {
+        auto const right = vm.pop_value();
+        auto const left = vm.pop_value();
+
+        std::size_t const length = broadcast_length({&left, &right});
+        std::vector<double> left_storage, right_storage;
+        double const* const left_vals = broadcast(left, length, left_storage);
+
+        auto out = make_array(length);
+        std::copy_n(left_vals, length, out->data());
+        apply(m_action, out->data(), broadcast(right, length, right_storage),
+              length);
+        vm.push(Value(std::move(out), broadcast_cols({&left, &right})));
+    }
+
+    Action m_action;
+    std::unique_ptr<Node> m_left, m_right;
+    bool m_short_circuit;
+};
+
+// `cond ? a : b` and `if(cond, a, b)`
+class ConditionalNode : public Node {
+    std::unique_ptr<Node> m_cond, m_then, m_else;
+    bool m_branch;
+
+   public:
+    ConditionalNode(std::unique_ptr<Node>&& cond,
+                    std::unique_ptr<Node>&& then,
+                    std::unique_ptr<Node>&& otherwise)
+        : m_cond(std::move(cond)),
+          m_then(std::move(then)),
+          m_else(std::move(otherwise)),
+          m_branch(std::max(m_then->cost(), m_else->cost()) > kBranchCost) {}
+
+    void execute(VirtualMachine& vm) override {
+        m_cond->execute(vm);
+
+        // an array condition picks per element, from both sides
+        if (vm.peek().is_array()) {
+            auto const cond = vm.pop_value();
+            m_then->execute(vm);
+            m_else->execute(vm);
+            auto const otherwise = vm.pop_value();
+            auto const then = vm.pop_value();
+
+            std::size_t const length =
+                broadcast_length({&cond, &then, &otherwise});
+            std::vector<double> then_storage, else_storage;
+            double const* const then_vals =
+                broadcast(then, length, then_storage);
+            double const* const else_vals =
+                broadcast(otherwise, length, else_storage);
+            double const* const cond_vals = cond.array().data();
+
+            auto out = make_array(length);
+            for (std::size_t i = 0; i < length; i++)
+                (*out)[i] = cond_vals[i] != 0 ? then_vals[i] : else_vals[i];
+            vm.push(Value(std::move(out),
+                          broadcast_cols({&cond, &then, &otherwise})));
+            return;
+        }
+
+        bool const cond = Arithmetic<double>::truthy(vm.pop());
+
+        if (m_branch) {
+            (cond ? m_then : m_else)->execute(vm);
+            return;
+        }
+
+        m_then->execute(vm);
+        m_else->execute(vm);
+
+        if (vm.peek(0).is_array() or vm.peek(1).is_array()) {
+            auto otherwise = vm.pop_value();
+            auto then = vm.pop_value();
+            vm.push(cond ? std::move(then) : std::move(otherwise));
+            return;
+        }
+
+        auto const otherwise = vm.pop();
+        auto const then = vm.pop();
+        vm.push(select(cond, then, otherwise));
+    }
+
+    void bind(ColumnSchema& schema, VirtualMachine& vm) override {
+        m_cond->bind(schema, vm);
+        m_then->bind(schema, vm);
+        m_else->bind(schema, vm);
+    }
+
+    // both sides are computed for the whole block and blended, unless the
+    // block turns out to go one way only
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>& frame, T* out) {
+        std::size_t const rows = frame.rows;
+        T* const cond = frame.scratch.acquire();
+        m_cond->execute_block(frame, cond);
+
+        if (m_branch) {
+            std::size_t taken = 0;
+            for (std::size_t i = 0; i < rows; i++)
+                taken += row_truthy(cond[i]);
+
+            if (taken == rows or taken == 0) {
+                (taken ? m_then : m_else)->execute_block(frame, out);
+                frame.scratch.release();
+                return;
+            }
+        }
+
+        m_then->execute_block(frame, out);
+        T* const otherwise = frame.scratch.acquire();
+        m_else->execute_block(frame, otherwise);
+
+        for (std::size_t i = 0; i < rows; i++)
+            out[i] = row_truthy(cond[i]) ? out[i] : otherwise[i];
+
+        frame.scratch.release();
+        frame.scratch.release();
+    }
+
+    unsigned cost() const noexcept override {
+        return 1 + m_cond->cost() + m_then->cost() + m_else->cost();
+    }
+
+    void compile(Program& program) const override {
+        m_cond->compile(program);
+        auto const skip = program.emit_jump(Instruction::JumpIfFalse);
+        m_then->compile(program);
+        auto const done = program.emit_jump(Instruction::Jump);
+        program.patch(skip);
+        m_else->compile(program);
+        program.patch(done);
+    }
+};
+
+// [a, b, c]
+class ArrayNode : public Node {
+    std::vector<std::unique_ptr<Node>> m_elements;
+
+   public:
+    ArrayNode(std::vector<std::unique_ptr<Node>>&& elements)
+        : m_elements(std::move(elements)) {}
+
+    void execute(VirtualMachine& vm) override {
+        if (m_elements.empty()) {
+            vm.push(make_array(0));
+            return;
+        }
+
+        // [[1, 2], [3, 4]] is a matrix, one row per element
+        m_elements[0]->execute(vm);
+        if (not vm.peek().is_array()) {
+            auto out = make_array(m_elements.size());
+            (*out)[0] = vm.pop();
+            for (std::size_t i = 1; i < m_elements.size(); i++) {
+                m_elements[i]->execute(vm);
+                (*out)[i] = vm.pop();
+            }
+
+            vm.push(std::move(out));
+            return;
+        }
+
+        auto const first = vm.pop_value();
+        std::size_t const cols = first.array().size();
+        if (first.is_matrix() or cols == 0)
+            throw std::runtime_error("Matrix rows must be non-empty arrays\n");
+
+        auto out = make_array(m_elements.size() * cols);
+        std::copy_n(first.array().data(), cols, out->data());
+        for (std::size_t i = 1; i < m_elements.size(); i++) {
+            m_elements[i]->execute(vm);
+            auto const row = vm.pop_value();
+            if (row.is_matrix() or row.array().size() != cols)
+                throw std::runtime_error("Matrix rows differ in length\n");
+            std::copy_n(row.array().data(), cols, out->data() + i * cols);
+        }
+
+        vm.push(Value(std::move(out), cols));
+    }
+
+    void bind(ColumnSchema&, VirtualMachine&) override {
+        throw std::runtime_error("Arrays can't be used in a column "
+                                 "expression\n");
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>&, T*) {
+        throw std::runtime_error("Arrays can't be used in a column "
+                                 "expression\n");
+    }
+
+    unsigned cost() const noexcept override {
+        unsigned out = 1;
+        for (auto const& element : m_elements)
+            out += element->cost();
+        return out;
+    }
+
+    void compile(Program& program) const override {
+        for (auto const& element : m_elements)
+            element->compile(program);
+        program.emit(Instruction::MakeArray, m_elements.size());
+    }
+};
+
+class CallNode : public Node {
+    Builtin const& m_builtin;
+    std::vector<std::unique_ptr<Node>> m_args;
+
+   public:
+    CallNode(Builtin const& builtin, std::vector<std::unique_ptr<Node>>&& args)
+        : m_builtin(builtin), m_args(std::move(args)) {}
+
+    void execute(VirtualMachine& vm) override {
+        std::vector<Value> args;
+        for (auto const& arg : m_args) {
+            arg->execute(vm);
+            args.push_back(vm.pop_value());
+        }
+
+        vm.push(m_builtin.call(args, vm));
+    }
+
+    // the builtins work on whole arrays, a row at a time they're meaningless
+    void bind(ColumnSchema&, VirtualMachine&) override {
+        throw std::runtime_error(std::string(m_builtin.name) +
+                                 "() can't be used in a column expression\n");
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>&, T*) {
+        throw std::runtime_error(std::string(m_builtin.name) +
+                                 "() can't be used in a column expression\n");
+    }
+
+    // calls walk whole arrays, never worth evaluating speculatively
+    unsigned cost() const noexcept override { return kBranchCost + 1; }
+
+    void compile(Program&) const override {
+        throw std::runtime_error(std::string(m_builtin.name) +
+                                 "() needs the default number mode\n");
+    }
+};
+
+// scan(v, op) for op one of + * min max, the general form of cumsum and
+// friends
+class ScanNode : public Node {
+   public:
+    enum Operation {
+        Add,
+        Multiply,
+        Min,
+        Max,
+    };
+
+    ScanNode(Operation operation, std::unique_ptr<Node>&& operand)
+        : m_operation(operation), m_operand(std::move(operand)) {}
+
+    void execute(VirtualMachine& vm) override {
+        m_operand->execute(vm);
+        auto const value = vm.pop_value();
+        auto const& values = value.array();
+
+        switch (m_operation) {
+            case Add:
+                vm.push(parallel_scan<ScanAdd>(values, vm.threads()));
+                break;
+            case Multiply:
+                vm.push(parallel_scan<ScanMultiply>(values, vm.threads()));
+                break;
+            case Min:
+                vm.push(parallel_scan<ScanMin>(values, vm.threads()));
+                break;
+            case Max:
+                vm.push(parallel_scan<ScanMax>(values, vm.threads()));
+                break;
+        }
+    }
+
+    void bind(ColumnSchema&, VirtualMachine&) override {
+        throw std::runtime_error("scan() can't be used in a column "
+                                 "expression\n");
+    }
+
+    BLOCK_NODE
+
+    template <typename T>
+    void block(BlockFrame<T>&, T*) {
+        throw std::runtime_error("scan() can't be used in a column "
+                                 "expression\n");
+    }
+
+    unsigned cost() const noexcept override { return kBranchCost + 1; }
+
+    void compile(Program&) const override {
+        throw std::runtime_error("scan() needs the default number mode\n");
+    }
+
+   private:
+    Operation m_operation;
+    std::unique_ptr<Node> m_operand;
+};
+
+class Parser {
+    CompileContext const& m_ctx;
+
+    std::vector<Token> const& m_toks;
+    unsigned m_idx;
+
+    Parser(CompileContext const& ctx, std::vector<Token> const& toks)
+        : m_ctx(ctx), m_toks(toks), m_idx(0) {}
+
+    std::unique_ptr<Node> parse_assignment() {
+        auto const& tok = m_toks[m_idx];
+        if (tok.m_type != Token::Type::Identifier)
+            throw std::runtime_error(
+                "Expected an identifier on the left-side of an "
+                "assignment.\n");
+        auto name = m_ctx.get_from_range(tok.m_range);
+        // we already know there is an equals sign...
+        m_idx += 2;
+        auto rhs = parse_expr();
+
+        return std::make_unique<AssignmentNode>(
+            AssignmentNode(name, std::move(rhs)));
+    }
+
+    std::unique_ptr<Node> parse_fact() {
+        auto const& tok = m_toks[m_idx];
+
+        m_idx += 1;
+
+        switch (tok.m_type) {
+            case Token::Type::Number: {
+                std::string str = m_ctx.get_from_range(tok.m_range);
+                try {
+                    return std::make_unique<NumberNode>(
+                        NumberNode(std::stod(str), str));
+                } catch (std::out_of_range const&) {
+                    // an error only where a double is needed, the exact
+                    // number modes parse the text
+                    return std::make_unique<NumberNode>(
+                        NumberNode(std::nullopt, str));
+                } catch (std::exception const& e) {
+                    throw std::runtime_error("invalid number conversion error");
+                }
+            };
+
+            case Token::Type::Identifier: {
+                auto name = m_ctx.get_from_range(tok.m_range);
+                if (m_toks[m_idx].m_type == Token::Type::LeftParanthesis) {
+                    if (name == "if")
+                        return parse_if();
+                    if (name == "scan")
+                        return parse_scan();
+                    return parse_call(name);
+                }
+
+                return std::make_unique<IdentNode>(IdentNode(name));
+            }
+
+            case Token::Type::LeftBracket:
+                return std::make_unique<ArrayNode>(
+                    ArrayNode(parse_list(Token::Type::RightBracket)));
+
+            case Token::Type::Minus:
+                return std::make_unique<UnaryNode>(
+                    UnaryNode(UnaryNode::Action::Negate, parse_fact()));
+
+            case Token::Type::Plus:
+            case Token::Type::Asterisk:
+            case Token::Type::Solidus:
+            case Token::Type::RightParanthesis:
+            case Token::Type::RightBracket:
+            case Token::Type::Equals:
+            case Token::Type::EqualsEquals:
+            case Token::Type::ExclamationEquals:
+            case Token::Type::Less:
+            case Token::Type::LessEquals:
+            case Token::Type::Greater:
+            case Token::Type::GreaterEquals:
+            case Token::Type::QuestionMark:
+            case Token::Type::Colon:
+            case Token::Type::Comma:
+            case Token::Type::And:
+            case Token::Type::Or:
+            case Token::Type::Not:
+                throw std::runtime_error("Invalid token in parse stream\n");
+
+            case Token::Type::End:
+                throw std::runtime_error("Unexpected end of input\n");
+
+            case Token::Type::LeftParanthesis:
+                auto ret_val = parse_expr();
+                if (m_toks[m_idx].m_type != Token::Type::RightParanthesis)
+                    throw std::runtime_error("Expected a right-paranthesis\n");
+                m_idx += 1;
+                return ret_val;
+        }
+
+        throw std::runtime_error("Invalid token in parse stream\n");
+    }
+
+    std::unique_ptr<Node> parse_term() {
+        auto left = parse_fact();
+
+        for (;;) {
+            auto const& op = m_toks[m_idx];
+
+            if (op.m_type != Token::Type::Asterisk and
+                op.m_type != Token::Type::Solidus)
+                break;
+
+            m_idx += 1;
+
+            auto right = parse_fact();
+
+            left = std::make_unique<BinaryNode>(
+                BinaryNode(op.m_type == Token::Type::Asterisk
+                               ? BinaryNode::Action::Multiply
+                               : BinaryNode::Action::Divide,
+                           std::move(left), std::move(right)));
+        }
+
+        return left;
+    }
+
+    void expect(Token::Type const type, char const* what) {
+        if (m_toks[m_idx].m_type != type)
+            throw std::runtime_error(std::string("Expected ") + what + "\n");
+        m_idx += 1;
+    }
+
+    // if(cond, a, b), with the `if` already consumed
+    std::unique_ptr<Node> parse_if() {
+        expect(Token::Type::LeftParanthesis, "a left-paranthesis");
+        auto cond = parse_expr();
+        expect(Token::Type::Comma, "a comma");
+        auto then = parse_expr();
+        expect(Token::Type::Comma, "a comma");
+        auto otherwise = parse_expr();
+        expect(Token::Type::RightParanthesis, "a right-paranthesis");
+
+        return std::make_unique<ConditionalNode>(ConditionalNode(
+            std::move(cond), std::move(then), std::move(otherwise)));
+    }
+
+    // scan(v, op), with the `scan` already consumed. the operator is
+    // written as itself: + * min max
+    std::unique_ptr<Node> parse_scan() {
+        expect(Token::Type::LeftParanthesis, "a left-paranthesis");
+        auto operand = parse_expr();
+        expect(Token::Type::Comma, "a comma");
+
+        auto const& op = m_toks[m_idx];
+        auto const word = m_ctx.get_from_range(op.m_range);
+        ScanNode::Operation operation;
+        if (op.m_type == Token::Type::Plus)
+            operation = ScanNode::Operation::Add;
+        else if (op.m_type == Token::Type::Asterisk)
+            operation = ScanNode::Operation::Multiply;
+        else if (op.m_type == Token::Type::Identifier and word == "min")
+            operation = ScanNode::Operation::Min;
+        else if (op.m_type == Token::Type::Identifier and word == "max")
+            operation = ScanNode::Operation::Max;
+        else
+            throw std::runtime_error("Expected one of + * min max\n");
+
+        m_idx += 1;
+        expect(Token::Type::RightParanthesis, "a right-paranthesis");
+
+        return std::make_unique<ScanNode>(
+            ScanNode(operation, std::move(operand)));
+    }
+
+    // comma separated expressions up to `close`, which is consumed. the
+    // opening token already is
+    std::vector<std::unique_ptr<Node>> parse_list(Token::Type const close) {
+        std::vector<std::unique_ptr<Node>> out;
+        if (m_toks[m_idx].m_type == close) {
+            m_idx += 1;
+            return out;
+        }
+
+        for (;;) {
+            out.push_back(parse_expr());
+
+            if (m_toks[m_idx].m_type == close) {
+                m_idx += 1;
+                return out;
+            }
+            expect(Token::Type::Comma, "a comma");
+        }
+    }
+
+    // name(args...), with the name already consumed
+    std::unique_ptr<Node> parse_call(std::string const& name) {
+        auto const* builtin = find_builtin(name);
+        if (not builtin)
+            throw std::runtime_error("Unknown function \"" + name + "\"\n");
+
+        m_idx += 1;
+        auto args = parse_list(Token::Type::RightParanthesis);
+        if (args.size() < builtin->min_args or
+            args.size() > builtin->max_args)
+            throw std::runtime_error("Wrong number of arguments to " + name +
+                                     "()\n");
+
+        return std::make_unique<CallNode>(CallNode(*builtin, std::move(args)));
+    }
+
+    std::unique_ptr<Node> parse_sum() {
+        auto left = parse_term();
+
+        for (;;) {
+            auto const& op = m_toks[m_idx];
+
+            if (op.m_type != Token::Type::Plus and
+                op.m_type != Token::Type::Minus)
+                break;
+
+            m_idx += 1;
+
+            auto right = parse_term();
+
+            left = std::make_unique<BinaryNode>(BinaryNode(
+                op.m_type == Token::Type::Plus ? BinaryNode::Action::Add
+                                               : BinaryNode::Action::Subtract,
+                std::move(left), std::move(right)));
+        }
+
+        return left;
+    }
+
+    std::unique_ptr<Node> parse_comparison() {
+        auto left = parse_sum();
+
+        for (;;) {
+            BinaryNode::Action action;
+            switch (m_toks[m_idx].m_type) {
+                case Token::Type::Less:
+                    action = BinaryNode::Action::Less;
+                    break;
+                case Token::Type::LessEquals:
+                    action = BinaryNode::Action::LessEqual;
+                    break;
+                case Token::Type::Greater:
+                    action = BinaryNode::Action::Greater;
+                    break;
+                case Token::Type::GreaterEquals:
+                    action = BinaryNode::Action::GreaterEqual;
+                    break;
+                case Token::Type::EqualsEquals:
+                    action = BinaryNode::Action::Equal;
+                    break;
+                case Token::Type::ExclamationEquals:
+                    action = BinaryNode::Action::NotEqual;
+                    break;
+                default:
+                    return left;
+            }
+
+            m_idx += 1;
+
+            auto right = parse_sum();
+
+            left = std::make_unique<BinaryNode>(
+                BinaryNode(action, std::move(left), std::move(right)));
+        }
+    }
+
+    std::unique_ptr<Node> parse_not() {
+        if (m_toks[m_idx].m_type != Token::Type::Not)
+            return parse_comparison();
+
+        m_idx += 1;
+
+        return std::make_unique<UnaryNode>(
+            UnaryNode(UnaryNode::Action::Not, parse_not()));
+    }
+
+    std::unique_ptr<Node> parse_and() {
+        auto left = parse_not();
+
+        while (m_toks[m_idx].m_type == Token::Type::And) {
+            m_idx += 1;
+
+            auto right = parse_not();
+
+            left = std::make_unique<LogicalNode>(LogicalNode(
+                LogicalNode::Action::And, std::move(left), std::move(right)));
+        }
+
+        return left;
+    }
+
+    std::unique_ptr<Node> parse_or() {
+        auto left = parse_and();
+
+        while (m_toks[m_idx].m_type == Token::Type::Or) {
+            m_idx += 1;
+
+            auto right = parse_and();
+
+            left = std::make_unique<LogicalNode>(LogicalNode(
+                LogicalNode::Action::Or, std::move(left), std::move(right)));
+        }
+
+        return left;
+    }
+
+    // cond ? a : b, right associative
+    std::unique_ptr<Node> parse_expr() {
+        auto cond = parse_or();
+
+        if (m_toks[m_idx].m_type != Token::Type::QuestionMark)
+            return cond;
+
+        m_idx += 1;
+
+        auto then = parse_expr();
+        expect(Token::Type::Colon, "a colon");
+        auto otherwise = parse_expr();
+
+        return std::make_unique<ConditionalNode>(ConditionalNode(
+            std::move(cond), std::move(then), std::move(otherwise)));
+    }
+
+    std::unique_ptr<Node> parse_expr_or_statement() {
+        // quick hack to get assignment parsing working
+        if (m_idx < m_toks.size() - 1) {
+            if (m_toks[m_idx + 1].m_type == Token::Type::Equals)
+                return parse_assignment();
+        }
+
+        return parse_expr();
+    }
+
+   public:
+    static std::unique_ptr<Node> parse(CompileContext const& ctx,
+                                       std::vector<Token> const& toks) {
+        PhaseScope const phase(Phase::Parse);
+        Parser parser(ctx, toks);
+        auto out = parser.parse_expr_or_statement();
+
+        if (parser.m_toks[parser.m_idx].m_type != Token::Type::End)
+            throw std::runtime_error("Unexpected trailing input\n");
+
+        return out;
+    }
+};
+
+// a number literal as its digits and the count of them after the point,
+// "12.50" is {"1250", 2}. leading zeros are dropped
+struct DecimalLiteral {
+    std::string digits;
+    unsigned scale = 0;
+
+    static DecimalLiteral parse(std::string_view const literal) {
+        DecimalLiteral out;
+        bool point = false;
+        for (char const c : literal) {
+            if (c == '.' and not point) {
+                point = true;
+                continue;
+            }
+            if (not isdigit(static_cast<unsigned char>(c)))
+                throw std::runtime_error("Invalid number \"" +
+                                         std::string(literal) + "\"\n");
+            if (not(out.digits.empty() and c == '0'))
+                out.digits += c;
+            out.scale += point;
+        }
+
+        if (literal == ".")
+            throw std::runtime_error("Invalid number \".\"\n");
+        return out;
+    }
+};
+
+template <typename T>
+struct LimbAllocator {
+    using value_type = T;
+
+    LimbAllocator() = default;
+    template <typename U>
+    LimbAllocator(LimbAllocator<U> const&) noexcept {}
+
+    T* allocate(std::size_t const n) {
+        return static_cast<T*>(BlockArena::local().allocate(n * sizeof(T)));
+    }
+    void deallocate(T* const p, std::size_t const n) noexcept {
+        BlockArena::local().deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(LimbAllocator<U> const&) const noexcept {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(LimbAllocator<U> const&) const noexcept {
+        return false;
+    }
+};
+
+// arbitrary size integer as sign and magnitude. the magnitude is little
+// endian 32-bit limbs without leading zeros, empty for zero
+class BigInt {
+    using Limbs = std::vector<std::uint32_t, LimbAllocator<std::uint32_t>>;
+
+    // below this many limbs in the shorter factor schoolbook multiplication
+    // wins, its loop is simple enough to beat karatsuba's extra additions
+    static constexpr std::size_t kKaratsubaLimbs = 40;
+    // literals longer than this many digits are converted by halves
+    static constexpr std::size_t kSplitDigits = 360;
+
+    Limbs m_limbs;
+    bool m_negative = false;
+
+    void trim() {
+        while (not m_limbs.empty() and m_limbs.back() == 0)
+            m_limbs.pop_back();
+        if (m_limbs.empty())
+            m_negative = false;
+    }
+
+    static int compare_magnitude(Limbs const& a, Limbs const& b) {
+        if (a.size() != b.size())
+            return a.size() < b.size() ? -1 : 1;
+        for (std::size_t i = a.size(); i-- > 0;) {
+            if (a[i] != b[i])
+                return a[i] < b[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    static Limbs add_magnitude(Limbs const& a, Limbs const& b) {
+        Limbs const& longer = a.size() >= b.size() ? a : b;
+        Limbs const& shorter = a.size() >= b.size() ? b : a;
+
+        Limbs out(longer.size() + 1);
+        std::uint64_t carry = 0;
+        for (std::size_t i = 0; i < longer.size(); i++) {
+            carry += std::uint64_t(longer[i]) +
+                     (i < shorter.size() ? shorter[i] : 0);
+            out[i] = std::uint32_t(carry);
+            carry >>= 32;
+        }
+        out.back() = carry;
+        return out;
+    }
+
+    // |a| >= |b|
+    static Limbs subtract_magnitude(Limbs const& a, Limbs const& b) {
+        Limbs out(a.size());
+        std::int64_t borrow = 0;
+        for (std::size_t i = 0; i < a.size(); i++) {
+            std::int64_t const diff =
+                std::int64_t(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+            out[i] = std::uint32_t(diff);
+            borrow = diff < 0;
+        }
+        return out;
+    }
+
+    static void trim(Limbs& limbs) {
+        while (not limbs.empty() and limbs.back() == 0)
+            limbs.pop_back();
+    }
+
+    static Limbs schoolbook(Limbs const& a, Limbs const& b) {
+        Limbs out(a.size() + b.size());
+        for (std::size_t i = 0; i < a.size(); i++) {
+            std::uint64_t carry = 0;
+            for (std::size_t j = 0; j < b.size(); j++) {
+                carry += std::uint64_t(a[i]) * b[j] + out[i + j];
+                out[i + j] = std::uint32_t(carry);
+                carry >>= 32;
+            }
+            out[i + b.size()] = std::uint32_t(carry);
+        }
+        return out;
+    }
+
+    // out += value << (32 * offset), out is long enough
+    static void add_shifted(Limbs& out, Limbs const& value,
+                            std::size_t const offset) {
+        std::uint64_t carry = 0;
+        std::size_t i = 0;
+        for (; i < value.size(); i++) {
+            carry += std::uint64_t(out[offset + i]) + value[i];
+            out[offset + i] = std::uint32_t(carry);
+            carry >>= 32;
+        }
+        for (; carry; i++) {
+            carry += out[offset + i];
+            out[offset + i] = std::uint32_t(carry);
+            carry >>= 32;
+        }
+    }
+
+    static Limbs slice(Limbs const& limbs, std::size_t const begin,
+                       std::size_t const end) {
+        Limbs out(limbs.begin() + std::min(begin, limbs.size()),
+                  limbs.begin() + std::min(end, limbs.size()));
+        trim(out);
+        return out;
+    }
+
+    // a0*b0 + ((a0+a1)(b0+b1) - a0*b0 - a1*b1) << half + a1*b1 << 2*half
+    static Limbs multiply_magnitude(Limbs const& a, Limbs const& b) {
+        if (a.empty() or b.empty())
+            return {};
+        if (std::min(a.size(), b.size()) < kKaratsubaLimbs)
+            return schoolbook(a, b);
+
+        Limbs out(a.size() + b.size() + 1);
+        std::size_t const half = std::max(a.size(), b.size()) / 2;
+
+        // lopsided factors: split only the long one
+        if (std::min(a.size(), b.size()) <= half) {
+            Limbs const& longer = a.size() > b.size() ? a : b;
+            Limbs const& shorter = a.size() > b.size() ? b : a;
+            add_shifted(out, multiply_magnitude(slice(longer, 0, half), shorter),
+                        0);
+            add_shifted(out,
+                        multiply_magnitude(slice(longer, half, longer.size()),
+                                           shorter),
+                        half);
+            trim(out);
+            return out;
+        }
+
+        Limbs const a0 = slice(a, 0, half), a1 = slice(a, half, a.size());
+        Limbs const b0 = slice(b, 0, half), b1 = slice(b, half, b.size());
+        Limbs const low = multiply_magnitude(a0, b0);
+        Limbs const high = multiply_magnitude(a1, b1);
+
+        Limbs a_sum = add_magnitude(a0, a1), b_sum = add_magnitude(b0, b1);
+        trim(a_sum);
+        trim(b_sum);
+        Limbs middle = multiply_magnitude(a_sum, b_sum);
+        trim(middle);
+        middle = subtract_magnitude(middle, low);
+        trim(middle);
+        middle = subtract_magnitude(middle, high);
+        trim(middle);
+
+        add_shifted(out, low, 0);
+        add_shifted(out, middle, half);
+        add_shifted(out, high, 2 * half);
+        trim(out);
+        return out;
+    }
+
+    // divides the magnitude in place, returns the remainder
+    std::uint32_t divide_small(std::uint32_t const divisor) {
+        std::uint64_t rem = 0;
+        for (std::size_t i = m_limbs.size(); i-- > 0;) {
+            std::uint64_t const cur = (rem << 32) | m_limbs[i];
+            m_limbs[i] = std::uint32_t(cur / divisor);
+            rem = cur % divisor;
+        }
+        trim();
+        return rem;
+    }
+
+    void multiply_add_small(std::uint32_t const factor,
+                            std::uint32_t const addend) {
+        std::uint64_t carry = addend;
+        for (auto& limb : m_limbs) {
+            carry += std::uint64_t(limb) * factor;
+            limb = std::uint32_t(carry);
+            carry >>= 32;
+        }
+        if (carry)
+            m_limbs.push_back(carry);
+    }
+
+   public:
+    BigInt() = default;
+
+    BigInt(std::int64_t const value) : m_negative(value < 0) {
+        // negating through unsigned works for the minimum too
+        std::uint64_t magnitude = value < 0 ? 0 - std::uint64_t(value) : value;
+        for (; magnitude != 0; magnitude >>= 32)
+            m_limbs.push_back(std::uint32_t(magnitude));
+    }
+
+    // decimal digits, nothing else. long ones are split in halves and
+    // joined as high * 10^n + low, which lets karatsuba do the heavy part
+    static BigInt parse(std::string_view digits) {
+        if (digits.size() > kSplitDigits) {
+            std::size_t const low_digits = digits.size() / 2;
+            BigInt const high =
+                parse(digits.substr(0, digits.size() - low_digits));
+            BigInt const low = parse(digits.substr(digits.size() - low_digits));
+            return high * power_of_ten(low_digits) + low;
+        }
+
+        BigInt out;
+        while (not digits.empty()) {
+            std::size_t const take = std::min<std::size_t>(9, digits.size());
+            std::uint32_t chunk = 0, scale = 1;
+            for (std::size_t i = 0; i < take; i++) {
+                chunk = chunk * 10 + (digits[i] - '0');
+                scale *= 10;
+            }
+            out.multiply_add_small(scale, chunk);
+            digits.remove_prefix(take);
+        }
+        return out;
+    }
+
+    // by squaring, so big powers ride on karatsuba too
+    static BigInt power_of_ten(unsigned exponent) {
+        BigInt out = 1, base = 10;
+        for (; exponent != 0; exponent >>= 1) {
+            if (exponent & 1)
+                out = out * base;
+            if (exponent > 1)
+                base = base * base;
+        }
+        return out;
+    }
+
+    bool is_zero() const noexcept { return m_limbs.empty(); }
+    bool is_negative() const noexcept { return m_negative; }
+    bool is_odd() const noexcept {
+        return not m_limbs.empty() and (m_limbs.front() & 1);
+    }
+    std::size_t limbs() const noexcept { return m_limbs.size(); }
+
+    std::size_t bit_length() const noexcept {
+        return m_limbs.empty() ? 0
+                               : 32 * m_limbs.size() -
+                                     __builtin_clz(m_limbs.back());
+    }
+
+    bool test_bit(std::size_t const bit) const noexcept {
+        return bit / 32 < m_limbs.size() and (m_limbs[bit / 32] >> bit % 32) & 1;
+    }
+
+    std::optional<std::int64_t> to_int64() const {
+        if (m_limbs.size() > 2)
+            return std::nullopt;
+        std::uint64_t magnitude = 0;
+        for (std::size_t i = m_limbs.size(); i-- > 0;)
+            magnitude = (magnitude << 32) | m_limbs[i];
+        if (magnitude > std::uint64_t(std::numeric_limits<std::int64_t>::max()))
+            return std::nullopt;
+        return m_negative ? -std::int64_t(magnitude) : std::int64_t(magnitude);
+    }
+
+    BigInt operator-() const {
+        BigInt out = *this;
+        out.m_negative = not m_negative and not is_zero();
+        return out;
+    }
+
+    BigInt abs() const {
+        BigInt out = *this;
+        out.m_negative = false;
+        return out;
+    }
+
+    friend BigInt operator+(BigInt const& a, BigInt const& b) {
+        BigInt out;
+        if (a.m_negative == b.m_negative) {
+            out.m_limbs = add_magnitude(a.m_limbs, b.m_limbs);
+            out.m_negative = a.m_negative;
+        } else if (compare_magnitude(a.m_limbs, b.m_limbs) >= 0) {
+            out.m_limbs = subtract_magnitude(a.m_limbs, b.m_limbs);
+            out.m_negative = a.m_negative;
+        } else {
+            out.m_limbs = subtract_magnitude(b.m_limbs, a.m_limbs);
+            out.m_negative = b.m_negative;
+        }
+        out.trim();
+        return out;
+    }
+
+    friend BigInt operator-(BigInt const& a, BigInt const& b) {
+        return a + -b;
+    }
+
+    friend BigInt operator*(BigInt const& a, BigInt const& b) {
+        BigInt out;
+        out.m_limbs = multiply_magnitude(a.m_limbs, b.m_limbs);
+        out.m_negative = a.m_negative != b.m_negative;
+        out.trim();
+        return out;
+    }
+
+    // truncating division: the quotient rounds towards zero and the
+    // remainder takes the sign of the dividend. knuth's algorithm D
+    friend std::pair<BigInt, BigInt> divmod(BigInt const& a, BigInt const& b) {
+        if (b.is_zero())
+            throw std::runtime_error("Division by zero\n");
+
+        BigInt quot, rem;
+        if (compare_magnitude(a.m_limbs, b.m_limbs) < 0) {
+            rem = a;
+        } else if (b.m_limbs.size() == 1) {
+            quot = a.abs();
+            rem = BigInt(quot.divide_small(b.m_limbs.front()));
+        } else {
+            std::size_t const n = b.m_limbs.size();
+            std::size_t const m = a.m_limbs.size();
+            unsigned const shift = __builtin_clz(b.m_limbs.back());
+
+            // normalize so the divisor's top limb has its high bit set
+            Limbs vn(n), un(m + 1);
+            for (std::size_t i = n; i-- > 0;) {
+                vn[i] = b.m_limbs[i] << shift;
+                if (shift and i > 0)
+                    vn[i] |= b.m_limbs[i - 1] >> (32 - shift);
+            }
+            un[m] = shift ? a.m_limbs[m - 1] >> (32 - shift) : 0;
+            for (std::size_t i = m; i-- > 0;) {
+                un[i] = a.m_limbs[i] << shift;
+                if (shift and i > 0)
+                    un[i] |= a.m_limbs[i - 1] >> (32 - shift);
+            }
+
+            quot.m_limbs.assign(m - n + 1, 0);
+            for (std::size_t j = m - n + 1; j-- > 0;) {
+                std::uint64_t const top =
+                    (std::uint64_t(un[j + n]) << 32) | un[j + n - 1];
+                std::uint64_t qhat = top / vn[n - 1];
+                std::uint64_t rhat = top % vn[n - 1];
+                while (qhat >> 32 or
+                       qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+                    qhat -= 1;
+                    rhat += vn[n - 1];
+                    if (rhat >> 32)
+                        break;
+                }
+
+                std::int64_t borrow = 0, t;
+                for (std::size_t i = 0; i < n; i++) {
+                    std::uint64_t const p = qhat * vn[i];
+                    t = std::int64_t(un[i + j]) - borrow -
+                        std::int64_t(p & 0xffffffff);
+                    un[i + j] = std::uint32_t(t);
+                    borrow = std::int64_t(p >> 32) - (t >> 32);
+                }
+                t = std::int64_t(un[j + n]) - borrow;
+                un[j + n] = std::uint32_t(t);
+
+                // qhat was one too big, add the divisor back
+                if (t < 0) {
+                    qhat -= 1;
+                    std::uint64_t carry = 0;
+                    for (std::size_t i = 0; i < n; i++) {
+                        carry += std::uint64_t(un[i + j]) + vn[i];
+                        un[i + j] = std::uint32_t(carry);
+                        carry >>= 32;
+                    }
+                    un[j + n] += std::uint32_t(carry);
+                }
+                quot.m_limbs[j] = std::uint32_t(qhat);
+            }
+
+            rem.m_limbs.resize(n);
+            for (std::size_t i = 0; i < n; i++) {
+                rem.m_limbs[i] = un[i] >> shift;
+                if (shift)
+                    rem.m_limbs[i] |= un[i + 1] << (32 - shift);
+            }
+            quot.trim();
+        }
+
+        quot.m_negative = a.m_negative != b.m_negative;
+        quot.trim();
+        rem.m_negative = a.m_negative;
+        rem.trim();
+        return {std::move(quot), std::move(rem)};
+    }
+
+    friend bool operator==(BigInt const& a, BigInt const& b) {
+        return a.m_negative == b.m_negative and a.m_limbs == b.m_limbs;
+    }
+
+    friend bool operator<(BigInt const& a, BigInt const& b) {
+        if (a.m_negative != b.m_negative)
+            return a.m_negative;
+        int const cmp = compare_magnitude(a.m_limbs, b.m_limbs);
+        return a.m_negative ? cmp > 0 : cmp < 0;
+    }
+
+    unsigned trailing_zeros() const noexcept {
+        unsigned out = 0;
+        for (auto const limb : m_limbs) {
+            if (limb != 0)
+                return out + __builtin_ctz(limb);
+            out += 32;
+        }
+        return out;
+    }
+
+    void shift_right(unsigned const bits) {
+        std::size_t const limbs = bits / 32;
+        unsigned const shift = bits % 32;
+        if (limbs >= m_limbs.size()) {
+            m_limbs.clear();
+            trim();
+            return;
+        }
+
+        m_limbs.erase(m_limbs.begin(), m_limbs.begin() + limbs);
+        if (shift) {
+            for (std::size_t i = 0; i < m_limbs.size(); i++) {
+                m_limbs[i] >>= shift;
+                if (i + 1 < m_limbs.size())
+                    m_limbs[i] |= m_limbs[i + 1] << (32 - shift);
+            }
+        }
+        trim();
+    }
+
+    void shift_left(unsigned const bits) {
+        std::size_t const limbs = bits / 32;
+        unsigned const shift = bits % 32;
+        if (is_zero())
+            return;
+
+        if (shift) {
+            m_limbs.push_back(0);
+            for (std::size_t i = m_limbs.size(); i-- > 0;) {
+                m_limbs[i] <<= shift;
+                if (i > 0)
+                    m_limbs[i] |= m_limbs[i - 1] >> (32 - shift);
+            }
+        }
+        m_limbs.insert(m_limbs.begin(), limbs, 0);
+        trim();
+    }
+
+    std::string to_string() const {
+        if (is_zero())
+            return "0";
+
+        // nine digits at a time, least significant first
+        BigInt rest = abs();
+        std::vector<std::uint32_t> chunks;
+        while (not rest.is_zero())
+            chunks.push_back(rest.divide_small(1000000000));
+
+        std::string out = m_negative ? "-" : "";
+        out += std::to_string(chunks.back());
+        for (std::size_t i = chunks.size() - 1; i-- > 0;) {
+            std::string const chunk = std::to_string(chunks[i]);
+            out.append(9 - chunk.size(), '0');
+            out += chunk;
+        }
+        return out;
+    }
+};
+
+// stein's binary gcd: shifts and subtractions only
+inline std::uint64_t binary_gcd(std::uint64_t a, std::uint64_t b) {
+    if (a == 0 or b == 0)
+        return a | b;
+
+    unsigned const shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    do {
+        b >>= __builtin_ctzll(b);
+        if (a > b)
+            std::swap(a, b);
+        b -= a;
+    } while (b != 0);
+
+    return a << shift;
+}
+
+// the same on magnitudes of any size, result non-negative
+inline BigInt binary_gcd(BigInt a, BigInt b) {
+    a = a.abs();
+    b = b.abs();
+    if (a.is_zero() or b.is_zero())
+        return a.is_zero() ? b : a;
+
+    unsigned const shift = std::min(a.trailing_zeros(), b.trailing_zeros());
+    a.shift_right(a.trailing_zeros());
+    do {
+        b.shift_right(b.trailing_zeros());
+        if (b < a)
+            std::swap(a, b);
+        b = b - a;
+
+        // finish on machine words once both fit
+        auto const small_a = a.to_int64(), small_b = b.to_int64();
+        if (small_a and small_b) {
+            BigInt out(std::int64_t(binary_gcd(*small_a, *small_b)));
+            out.shift_left(shift);
+            return out;
+        }
+    } while (not b.is_zero());
+
+    a.shift_left(shift);
+    return a;
+}
+
+// exact fractions. num/den with den > 0, in int64 as long as they fit and
+// not reduced until something needs it: a chain of + and * only pays for a
+// gcd once its terms threaten to overflow. values that outgrow int64 even
+// when reduced move to big integers, kept in lowest terms
+class Rational {
+    struct Big {
+        BigInt num, den;
+    };
+
+    std::int64_t m_num = 0, m_den = 1;
+    std::shared_ptr<Big const> m_big;
+
+    using Wide = __int128;
+
+    static bool fits(Wide const value) {
+        return value >= std::numeric_limits<std::int64_t>::min() and
+               value <= std::numeric_limits<std::int64_t>::max();
+    }
+
+    static std::uint64_t magnitude(std::int64_t const value) {
+        return value < 0 ? 0 - std::uint64_t(value) : value;
+    }
+
+    // binary gcd over 128 bits, for results that came out too wide
+    static unsigned __int128 wide_gcd(unsigned __int128 a,
+                                      unsigned __int128 b) {
+        auto ctz = [](unsigned __int128 const v) {
+            auto const low = std::uint64_t(v);
+            return low ? __builtin_ctzll(low)
+                       : 64 + __builtin_ctzll(std::uint64_t(v >> 64));
+        };
+        if (a == 0 or b == 0)
+            return a | b;
+
+        unsigned const shift = ctz(a | b);
+        a >>= ctz(a);
+        do {
+            b >>= ctz(b);
+            if (a > b)
+                std::swap(a, b);
+            b -= a;
+        } while (b != 0);
+        return a << shift;
+    }
+
+    static Rational make_big(BigInt num, BigInt den) {
+        if (den.is_zero())
+            throw std::runtime_error("Division by zero\n");
+        if (den.is_negative()) {
+            num = -num;
+            den = -den;
+        }
+
+        BigInt const divisor = binary_gcd(num, den);
+        if (not(divisor == BigInt(1))) {
+            num = divmod(num, divisor).first;
+            den = divmod(den, divisor).first;
+        }
+
+        Rational out;
+        auto const small_num = num.to_int64(), small_den = den.to_int64();
+        if (small_num and small_den) {
+            out.m_num = *small_num;
+            out.m_den = *small_den;
+        } else {
+            out.m_big = std::make_shared<Big const>(
+                Big{.num = std::move(num), .den = std::move(den)});
+        }
+        return out;
+    }
+
+    // the fast path's result, reduced only if it doesn't fit as it is
+    static Rational make_wide(Wide num, Wide den) {
+        if (den == 0)
+            throw std::runtime_error("Division by zero\n");
+        if (den < 0) {
+            num = -num;
+            den = -den;
+        }
+
+        if (not fits(num) or not fits(den)) {
+            auto const divisor = Wide(
+                wide_gcd(num < 0 ? -(unsigned __int128)num : num, den));
+            num /= divisor;
+            den /= divisor;
+        }
+
+        if (fits(num) and fits(den)) {
+            Rational out;
+            out.m_num = std::int64_t(num);
+            out.m_den = std::int64_t(den);
+            return out;
+        }
+
+        return make_big(to_big(num), to_big(den));
+    }
+
+    static BigInt to_big(Wide const value) {
+        auto const high = std::int64_t(value >> 64);
+        auto const low = std::uint64_t(value);
+        BigInt out = BigInt(high);
+        out.shift_left(64);
+        BigInt low_part = BigInt(std::int64_t(low >> 32));
+        low_part.shift_left(32);
+        return out + low_part + BigInt(std::int64_t(low & 0xffffffff));
+    }
+
+    BigInt big_num() const { return m_big ? m_big->num : BigInt(m_num); }
+    BigInt big_den() const { return m_big ? m_big->den : BigInt(m_den); }
+
+   public:
+    Rational() = default;
+    Rational(std::int64_t const num) : m_num(num) {}
+
+    // "12.5" is 125/10, no rounding anywhere
+    static Rational parse(std::string_view const literal) {
+        auto const decimal = DecimalLiteral::parse(literal);
+        if (decimal.digits.size() <= 18 and decimal.scale <= 18) {
+            std::int64_t num = 0, den = 1;
+            for (char const c : decimal.digits)
+                num = num * 10 + (c - '0');
+            for (unsigned i = 0; i < decimal.scale; i++)
+                den *= 10;
+            return make_wide(num, den);
+        }
+
+        return make_big(BigInt::parse(decimal.digits),
+                        BigInt::power_of_ten(decimal.scale));
+    }
+
+    bool is_zero() const noexcept { return not m_big and m_num == 0; }
+    bool is_big() const noexcept { return m_big != nullptr; }
+
+    friend Rational operator+(Rational const& a, Rational const& b) {
+        if (a.m_big or b.m_big)
+            return make_big(a.big_num() * b.big_den() + b.big_num() * a.big_den(),
+                            a.big_den() * b.big_den());
+        if (a.m_den == b.m_den)
+            return make_wide(Wide(a.m_num) + b.m_num, a.m_den);
+        return make_wide(Wide(a.m_num) * b.m_den + Wide(b.m_num) * a.m_den,
+                         Wide(a.m_den) * b.m_den);
+    }
+
+    friend Rational operator-(Rational const& a, Rational const& b) {
+        return a + -b;
+    }
+
+    friend Rational operator*(Rational const& a, Rational const& b) {
+        if (a.m_big or b.m_big)
+            return make_big(a.big_num() * b.big_num(), a.big_den() * b.big_den());
+        return make_wide(Wide(a.m_num) * b.m_num, Wide(a.m_den) * b.m_den);
+    }
+
+    friend Rational operator/(Rational const& a, Rational const& b) {
+        if (b.is_zero())
+            throw std::runtime_error("Division by zero\n");
+        if (a.m_big or b.m_big)
+            return make_big(a.big_num() * b.big_den(), a.big_den() * b.big_num());
+        return make_wide(Wide(a.m_num) * b.m_den, Wide(a.m_den) * b.m_num);
+    }
+
+    Rational operator-() const {
+        if (m_big)
+            return make_big(-m_big->num, m_big->den);
+        return make_wide(-Wide(m_num), m_den);
+    }
+
+    // cross multiplied, so neither side has to be reduced
+    friend bool operator<(Rational const& a, Rational const& b) {
+        if (a.m_big or b.m_big)
+            return a.big_num() * b.big_den() < b.big_num() * a.big_den();
+        return Wide(a.m_num) * b.m_den < Wide(b.m_num) * a.m_den;
+    }
+
+    friend bool operator==(Rational const& a, Rational const& b) {
+        if (a.m_big or b.m_big)
+            return a.big_num() * b.big_den() == b.big_num() * a.big_den();
+        return Wide(a.m_num) * b.m_den == Wide(b.m_num) * a.m_den;
+    }
+
+    // lowest terms, `num/den` or just `num`
+    std::string to_string() const {
+        if (m_big) {
+            return m_big->den == BigInt(1)
+                       ? m_big->num.to_string()
+                       : m_big->num.to_string() + "/" + m_big->den.to_string();
+        }
+
+        std::uint64_t const divisor = binary_gcd(magnitude(m_num), m_den);
+        std::int64_t const num = m_num / std::int64_t(divisor);
+        std::int64_t const den = m_den / std::int64_t(divisor);
+        return den == 1 ? std::to_string(num)
+                        : std::to_string(num) + "/" + std::to_string(den);
+    }
+};
+
+template <>
+struct Arithmetic<Rational> {
+    using T = Rational;
+
+    static T parse(std::string_view const literal) {
+        return Rational::parse(literal);
+    }
+
+    static T add(T const& a, T const& b) { return a + b; }
+    static T subtract(T const& a, T const& b) { return a - b; }
+    static T multiply(T const& a, T const& b) { return a * b; }
+    static T divide(T const& a, T const& b) { return a / b; }
+    static T negate(T const& a) { return -a; }
+
+    static bool less(T const& a, T const& b) { return a < b; }
+    static bool equal(T const& a, T const& b) { return a == b; }
+    static bool truthy(T const& a) { return not a.is_zero(); }
+    static T from_bool(bool const b) { return std::int64_t(b); }
+
+    static std::string format(T const& a) { return a.to_string(); }
+};
+
+// binary floating point of configurable precision: mantissa * 2^exponent,
+// every result rounded to the working precision, to nearest even
+class BigFloat {
+    BigInt m_mantissa;
+    std::int64_t m_exponent = 0;
+
+    static inline unsigned s_digits = 50;
+
+    // working precision in bits, with a few guard bits over the digits
+    static std::size_t bits() noexcept {
+        return std::size_t(s_digits * 3.3219280948873623) + 8;
+    }
+
+    BigFloat(BigInt mantissa, std::int64_t const exponent)
+        : m_mantissa(std::move(mantissa)), m_exponent(exponent) {}
+
+    // drops the bits below the precision. the magnitude is rounded, so
+    // negative values round symmetrically
+    static BigFloat rounded(BigInt mantissa, std::int64_t exponent) {
+        std::size_t const length = mantissa.bit_length();
+        if (length > bits()) {
+            std::size_t const shift = length - bits();
+            bool const half = mantissa.test_bit(shift - 1);
+            bool const sticky = mantissa.trailing_zeros() < shift - 1;
+            bool const negative = mantissa.is_negative();
+
+            mantissa.shift_right(shift);
+            exponent += shift;
+            if (half and (sticky or mantissa.is_odd()))
+                mantissa = mantissa + BigInt(negative ? -1 : 1);
+        }
+
+        return BigFloat(std::move(mantissa), exponent);
+    }
+
+    // position just past the top bit, the magnitude is below 2^top()
+    std::int64_t top() const noexcept {
+        return m_exponent + std::int64_t(m_mantissa.bit_length());
+    }
+
+    // the mantissa of `value` scaled to `exponent`, which is no bigger than
+    // its own, so exactly
+    static BigInt aligned(BigFloat const& value, std::int64_t const exponent) {
+        BigInt out = value.m_mantissa;
+        out.shift_left(value.m_exponent - exponent);
+        return out;
+    }
+
+   public:
+    BigFloat() = default;
+    BigFloat(std::int64_t const value) : m_mantissa(value) {}
+
+    static void set_digits(unsigned const digits) noexcept {
+        s_digits = digits;
+    }
+
+    // the decimal is divided out once, so a literal is rounded only once
+    static BigFloat parse(std::string_view const literal) {
+        auto const decimal = DecimalLiteral::parse(literal);
+        BigFloat const digits(BigInt::parse(decimal.digits), 0);
+        if (decimal.scale == 0)
+            return rounded(digits.m_mantissa, 0);
+        return digits / BigFloat(BigInt::power_of_ten(decimal.scale), 0);
+    }
+
+    bool is_zero() const noexcept { return m_mantissa.is_zero(); }
+
+    friend BigFloat operator+(BigFloat const& a, BigFloat const& b) {
+        if (a.is_zero() or b.is_zero())
+            return rounded(a.is_zero() ? b.m_mantissa : a.m_mantissa,
+                           a.is_zero() ? b.m_exponent : a.m_exponent);
+
+        // an operand below a quarter of the other's last bit can't change
+        // the rounded sum
+        std::int64_t const slack = std::int64_t(bits()) + 2;
+        if (b.top() < a.top() - slack)
+            return rounded(a.m_mantissa, a.m_exponent);
+        if (a.top() < b.top() - slack)
+            return rounded(b.m_mantissa, b.m_exponent);
+
+        std::int64_t const exponent = std::min(a.m_exponent, b.m_exponent);
+        return rounded(aligned(a, exponent) + aligned(b, exponent), exponent);
+    }
+
+    BigFloat operator-() const { return BigFloat(-m_mantissa, m_exponent); }
+
+    friend BigFloat operator-(BigFloat const& a, BigFloat const& b) {
+        return a + -b;
+    }
+
+    friend BigFloat operator*(BigFloat const& a, BigFloat const& b) {
+        return rounded(a.m_mantissa * b.m_mantissa,
+                       a.m_exponent + b.m_exponent);
+    }
+
+    // the dividend is widened until the quotient has all the bits needed,
+    // plus one that records whether anything was left over
+    friend BigFloat operator/(BigFloat const& a, BigFloat const& b) {
+        if (b.is_zero())
+            throw std::runtime_error("Division by zero\n");
+        if (a.is_zero())
+            return BigFloat();
+
+        std::int64_t const shift =
+            std::max<std::int64_t>(0, bits() + 2 +
+                                          b.m_mantissa.bit_length() -
+                                          a.m_mantissa.bit_length());
+        BigInt dividend = a.m_mantissa;
+        dividend.shift_left(shift + 1);
+        auto [quot, rem] = divmod(dividend, b.m_mantissa);
+        if (not rem.is_zero())
+            quot = quot + BigInt(quot.is_negative() ? -1 : 1);
+
+        return rounded(std::move(quot), a.m_exponent - b.m_exponent - shift - 1);
+    }
+
+    // -1, 0 or 1, exactly
+    friend int compare(BigFloat const& a, BigFloat const& b) {
+        bool const a_neg = a.m_mantissa.is_negative();
+        bool const b_neg = b.m_mantissa.is_negative();
+        if (a_neg != b_neg or a.is_zero() or b.is_zero()) {
+            int const sa = a.is_zero() ? 0 : a_neg ? -1 : 1;
+            int const sb = b.is_zero() ? 0 : b_neg ? -1 : 1;
+            return (sa > sb) - (sa < sb);
+        }
+
+        // same sign: the one reaching higher is bigger in magnitude
+        if (a.top() != b.top())
+            return (a.top() > b.top()) != a_neg ? 1 : -1;
+
+        std::int64_t const exponent = std::min(a.m_exponent, b.m_exponent);
+        BigInt const x = aligned(a, exponent), y = aligned(b, exponent);
+        return x < y ? -1 : y < x ? 1 : 0;
+    }
+
+    // the working number of significant digits, trailing zeros dropped
+    std::string to_string() const {
+        if (is_zero())
+            return "0";
+
+        BigInt const magnitude = m_mantissa.abs();
+        // estimate of the decimal exponent, corrected below if it's off
+        std::int64_t const estimate = std::int64_t(
+            std::floor((top() - 1) * 0.30102999566398120));
+
+        std::string digits;
+        std::int64_t scale = std::int64_t(s_digits) - 1 - estimate;
+        for (unsigned attempt = 0; attempt < 3; attempt++) {
+            // round(|value| * 10^scale) as an integer
+            BigInt num = magnitude, den = 1;
+            if (scale >= 0)
+                num = num * BigInt::power_of_ten(scale);
+            else
+                den = BigInt::power_of_ten(-scale);
+            if (m_exponent >= 0)
+                num.shift_left(m_exponent);
+            else
+                den.shift_left(-m_exponent);
+
+            auto [quot, rem] = divmod(num, den);
+            rem.shift_left(1);
+            if (not(rem < den))
+                quot = quot + BigInt(1);
+
+            digits = quot.to_string();
+            if (digits.size() == s_digits)
+                break;
+            scale += digits.size() < s_digits ? 1 : -1;
+        }
+
+        std::string out;
+        if (scale <= 0) {
+            out = digits + std::string(-scale, '0');
+        } else {
+            if (std::int64_t(digits.size()) <= scale)
+                digits.insert(0, scale - digits.size() + 1, '0');
+            out = digits;
+            out.insert(out.size() - scale, ".");
+            while (out.back() == '0')
+                out.pop_back();
+            if (out.back() == '.')
+                out.pop_back();
+        }
+
+        return m_mantissa.is_negative() ? "-" + out : out;
+    }
+};
+
+Interval Interval::parse(std::string_view const literal) {
+    auto const decimal = DecimalLiteral::parse(literal);
+    double const r = std::strtod(std::string(literal).c_str(), nullptr);
+    if (std::isinf(r))
+        return {std::numeric_limits<double>::max(), r};
+    if (r == 0)
+        return {0, 0};
+
+    // r = mantissa * 2^exponent against digits / 10^scale, in integers
+    int exponent;
+    double const fraction = std::frexp(r, &exponent);
+    BigInt mantissa(std::int64_t(std::ldexp(fraction, 53)));
+    exponent -= 53;
+
+    BigInt exact = BigInt::parse(decimal.digits);
+    mantissa = mantissa * BigInt::power_of_ten(decimal.scale);
+    if (exponent < 0)
+        exact.shift_left(-exponent);
+    else
+        mantissa.shift_left(exponent);
+
+    if (exact == mantissa)
+        return {r, r};
+    return exact < mantissa ? Interval{down(r), r} : Interval{r, up(r)};
+}
+
+template <>
+struct Arithmetic<BigInt> {
+    using T = BigInt;
+
+    static T parse(std::string_view const literal) {
+        auto const decimal = DecimalLiteral::parse(literal);
+        if (decimal.scale != 0)
+            throw std::runtime_error("\"" + std::string(literal) +
+                                     "\" isn't an integer\n");
+        return BigInt::parse(decimal.digits);
+    }
+
+    static T add(T const& a, T const& b) { return a + b; }
+    static T subtract(T const& a, T const& b) { return a - b; }
+    static T multiply(T const& a, T const& b) { return a * b; }
+    // truncates towards zero
+    static T divide(T const& a, T const& b) { return divmod(a, b).first; }
+    static T negate(T const& a) { return -a; }
+
+    static bool less(T const& a, T const& b) { return a < b; }
+    static bool equal(T const& a, T const& b) { return a == b; }
+    static bool truthy(T const& a) { return not a.is_zero(); }
+    static T from_bool(bool const b) { return std::int64_t(b); }
+
+    static std::string format(T const& a) { return a.to_string(); }
+};
+
+template <>
+struct Arithmetic<BigFloat> {
+    using T = BigFloat;
+
+    static T parse(std::string_view const literal) {
+        return BigFloat::parse(literal);
+    }
+
+    static T add(T const& a, T const& b) { return a + b; }
+    static T subtract(T const& a, T const& b) { return a - b; }
+    static T multiply(T const& a, T const& b) { return a * b; }
+    static T divide(T const& a, T const& b) { return a / b; }
+    static T negate(T const& a) { return -a; }
+
+    static bool less(T const& a, T const& b) { return compare(a, b) < 0; }
+    static bool equal(T const& a, T const& b) { return compare(a, b) == 0; }
+    static bool truthy(T const& a) { return not a.is_zero(); }
+    static T from_bool(bool const b) { return std::int64_t(b); }
+
+    static std::string format(T const& a) { return a.to_string(); }
+};
+
+// complex arrays keep the real and the imaginary parts in separate planes,
+// so the kernels below walk plain double arrays and vectorize like the real
+// ones do
+struct ComplexPlanes {
+    std::vector<double> re;
+    std::vector<double> im;
+};
+
+// a complex number, or an array of them when planes is set
+struct Complex {
+    std::complex<double> scalar;
+    std::shared_ptr<ComplexPlanes const> planes;
+
+    Complex(std::complex<double> const scalar = {}) : scalar(scalar) {}
+    explicit Complex(std::shared_ptr<ComplexPlanes const> planes)
+        : planes(std::move(planes)) {}
+
+    // the planes of a length n array, a scalar repeated
+    std::shared_ptr<ComplexPlanes const> spread(std::size_t const n) const {
+        if (planes)
+            return planes;
+        return std::make_shared<ComplexPlanes const>(
+            ComplexPlanes{.re = std::vector<double>(n, scalar.real()),
+                          .im = std::vector<double>(n, scalar.imag())});
+    }
+};
+
+// out = a <op> b for the four arithmetic instructions. products and
+// quotients use the textbook formulas, smith's for division so it doesn't
+// overflow early, both without branches. where those end up nan in both
+// parts complex_fix_nans redoes the lane
+ISA_INLINE void complex_apply_body(Instruction::Op const op,
+                                   ComplexPlanes const& a,
+                                   ComplexPlanes const& b,
+                                   ComplexPlanes& out) {
+    std::size_t const n = out.re.size();
+    double const* const ar = a.re.data();
+    double const* const ai = a.im.data();
+    double const* const br = b.re.data();
+    double const* const bi = b.im.data();
+    double* const re = out.re.data();
+    double* const im = out.im.data();
+
+    switch (op) {
+        case Instruction::Add:
+            for (std::size_t i = 0; i < n; i++) {
+                re[i] = ar[i] + br[i];
+                im[i] = ai[i] + bi[i];
+            }
+            break;
+        case Instruction::Subtract:
+            for (std::size_t i = 0; i < n; i++) {
+                re[i] = ar[i] - br[i];
+                im[i] = ai[i] - bi[i];
+            }
+            break;
+        case Instruction::Multiply:
+            for (std::size_t i = 0; i < n; i++) {
+                re[i] = ar[i] * br[i] - ai[i] * bi[i];
+                im[i] = ar[i] * bi[i] + ai[i] * br[i];
+            }
+            break;
+        default:
+            for (std::size_t i = 0; i < n; i++) {
+                bool const wide = std::abs(br[i]) >= std::abs(bi[i]);
+                double const c = wide ? br[i] : bi[i];
+                double const d = wide ? bi[i] : br[i];
+                double const ratio = d / c;
+                double const den = c + d * ratio;
+                double const x = wide ? ar[i] : ai[i];
+                double const y = wide ? ai[i] : ar[i];
+                double const sign = wide ? 1 : -1;
+                re[i] = (x + y * ratio) / den;
+                im[i] = sign * (y - x * ratio) / den;
+            }
+            break;
+    }
+}
+
+ISA_DISPATCH(,
+             void,
+             complex_apply,
+             (Instruction::Op const op,
+              ComplexPlanes const& a,
+              ComplexPlanes const& b,
+              ComplexPlanes& out),
+             (op, a, b, out))
+
+// lanes where the fast formulas gave nan + nan i go through std::complex,
+// which follows annex g of c99: an infinite operand gives an infinite
+// result, a finite one divided by zero too
+void complex_fix_nans(Instruction::Op const op,
+                      ComplexPlanes const& a,
+                      ComplexPlanes const& b,
+                      ComplexPlanes& out) {
+    for (std::size_t i = 0; i < out.re.size(); i++) {
+        if (not(std::isnan(out.re[i]) and std::isnan(out.im[i])))
+            continue;
+        std::complex<double> const x(a.re[i], a.im[i]), y(b.re[i], b.im[i]);
+        auto const z = op == Instruction::Multiply ? x * y : x / y;
+        out.re[i] = z.real();
+        out.im[i] = z.imag();
+    }
+}
+
+template <>
+struct Arithmetic<Complex> {
+    using T = Complex;
+
+    static T parse(std::string_view const literal) {
+        if (literal == "i")
+            return T(std::complex<double>(0, 1));
+        return T(Arithmetic<double>::parse(literal));
+    }
+
+    static T make_array(T const* const values, std::size_t const count) {
+        auto planes = std::make_shared<ComplexPlanes>();
+        planes->re.resize(count);
+        planes->im.resize(count);
+        for (std::size_t i = 0; i < count; i++) {
+            if (values[i].planes)
+                throw std::runtime_error(
+                    "Nested arrays need the default number mode\n");
+            planes->re[i] = values[i].scalar.real();
+            planes->im[i] = values[i].scalar.imag();
+        }
+        return T(std::move(planes));
+    }
+
+    static T apply(Instruction::Op const op, T const& a, T const& b) {
+        if (not a.planes and not b.planes) {
+            switch (op) {
+                case Instruction::Add:
+                    return T(a.scalar + b.scalar);
+                case Instruction::Subtract:
+                    return T(a.scalar - b.scalar);
+                case Instruction::Multiply:
+                    return T(a.scalar * b.scalar);
+                default:
+                    return T(a.scalar / b.scalar);
+            }
+        }
+
+        if (a.planes and b.planes and a.planes->re.size() != b.planes->re.size())
+            throw std::runtime_error("Array lengths differ\n");
+        std::size_t const n = (a.planes ? a.planes : b.planes)->re.size();
+
+        auto const left = a.spread(n), right = b.spread(n);
+        auto out = std::make_shared<ComplexPlanes>();
+        out->re.resize(n);
+        out->im.resize(n);
+        complex_apply(op, *left, *right, *out);
+        if (op == Instruction::Multiply or op == Instruction::Divide)
+            complex_fix_nans(op, *left, *right, *out);
+        return T(std::move(out));
+    }
+
+    static T add(T const& a, T const& b) {
+        return apply(Instruction::Add, a, b);
+    }
+    static T subtract(T const& a, T const& b) {
+        return apply(Instruction::Subtract, a, b);
+    }
+    static T multiply(T const& a, T const& b) {
+        return apply(Instruction::Multiply, a, b);
+    }
+    static T divide(T const& a, T const& b) {
+        return apply(Instruction::Divide, a, b);
+    }
+
+    static T negate(T const& a) {
+        if (not a.planes)
+            return T(-a.scalar);
+        auto out = std::make_shared<ComplexPlanes>(*a.planes);
+        for (double& x : out->re)
+            x = -x;
+        for (double& x : out->im)
+            x = -x;
+        return T(std::move(out));
+    }
+
+    static std::complex<double> scalar(T const& a) {
+        if (a.planes)
+            throw std::runtime_error("Expected a number but got an array\n");
+        return a.scalar;
+    }
+
+    // only real numbers are ordered
+    static bool less(T const& a, T const& b) {
+        auto const x = scalar(a), y = scalar(b);
+        if (x.imag() != 0 or y.imag() != 0)
+            throw std::runtime_error("Complex numbers aren't ordered\n");
+        return x.real() < y.real();
+    }
+    static bool equal(T const& a, T const& b) { return scalar(a) == scalar(b); }
+    static bool truthy(T const& a) { return scalar(a) != 0.0; }
+    static T from_bool(bool const b) { return T(double(b)); }
+
+    // 1.5-2i, with the parts left out when they're zero
+    static std::string format(std::complex<double> const z) {
+        if (z.imag() == 0)
+            return Arithmetic<double>::format(z.real());
+        std::string const im =
+            Arithmetic<double>::format(std::abs(z.imag())) + "i";
+        if (z.real() == 0)
+            return std::signbit(z.imag()) ? "-" + im : im;
+        return Arithmetic<double>::format(z.real()) +
+               (std::signbit(z.imag()) ? "-" : "+") + im;
+    }
+
+    static std::string format(T const& a) {
+        if (not a.planes)
+            return format(a.scalar);
+
+        std::string out = "[";
+        for (std::size_t i = 0; i < a.planes->re.size(); i++) {
+            if (i)
+                out += ", ";
+            out += format({a.planes->re[i], a.planes->im[i]});
+        }
+        return out + "]";
+    }
+};
+
+// how a decimal result with more digits than the scale is cut back
+enum class Rounding {
+    HalfEven,
+    HalfUp,
+    Down,
+    Up,
+    Floor,
+    Ceiling,
+};
+
+constexpr char const* kRoundingNames[] = {"half-even", "half-up", "down",
+                                          "up",        "floor",   "ceiling"};
+
+// num / den rounded to an integer. half-up goes away from zero on a tie,
+// down and up are towards and away from zero
+inline __int128 round_divide(__int128 const num,
+                             __int128 const den,
+                             Rounding const rounding) {
+    __int128 const quot = num / den;
+    __int128 const rem = num % den;
+    if (rem == 0)
+        return quot;
+
+    int const sign = (num < 0) != (den < 0) ? -1 : 1;
+    __int128 const twice = 2 * (rem < 0 ? -rem : rem);
+    __int128 const whole = den < 0 ? -den : den;
+    bool away = false;
+    switch (rounding) {
+        case Rounding::HalfEven:
+            away = twice > whole or (twice == whole and quot % 2 != 0);
+            break;
+        case Rounding::HalfUp:
+            away = twice >= whole;
+            break;
+        case Rounding::Down:
+            break;
+        case Rounding::Up:
+            away = true;
+            break;
+        case Rounding::Floor:
+            away = sign < 0;
+            break;
+        case Rounding::Ceiling:
+            away = sign > 0;
+            break;
+    }
+    return away ? quot + sign : quot;
+}
+
+// fixed point decimal: an int64 count of 10^-scale units, so sums are exact
+// and every product or quotient is rounded once, the way ledgers do it. the
+// scale and the rounding are the same for every value of a run. arrays hold
+// the raw units
+struct Decimal {
+    std::int64_t units = 0;
+    std::shared_ptr<std::vector<std::int64_t> const> array;
+
+    static inline unsigned s_scale = 2;
+    // 10^s_scale, the units of 1
+    static inline std::int64_t s_one = 100;
+    static inline Rounding s_rounding = Rounding::HalfEven;
+
+    static constexpr unsigned kMaxScale = 18;
+
+    explicit Decimal(std::int64_t const units = 0) : units(units) {}
+    explicit Decimal(std::shared_ptr<std::vector<std::int64_t> const> array)
+        : array(std::move(array)) {}
+
+    static void set_scale(unsigned const scale) noexcept {
+        s_scale = scale;
+        s_one = 1;
+        for (unsigned i = 0; i < scale; i++)
+            s_one *= 10;
+    }
+
+    [[noreturn]] static void overflow() {
+        throw std::runtime_error("Decimal overflow\n");
+    }
+
+    static std::int64_t narrow(__int128 const value) {
+        if (value < std::numeric_limits<std::int64_t>::min() or
+            value > std::numeric_limits<std::int64_t>::max())
+            overflow();
+        return std::int64_t(value);
+    }
+
+    static std::int64_t multiply_units(std::int64_t const a,
+                                       std::int64_t const b) {
+        return narrow(round_divide(__int128(a) * b, s_one, s_rounding));
+    }
+
+    static std::int64_t divide_units(std::int64_t const a,
+                                     std::int64_t const b) {
+        if (b == 0)
+            throw std::runtime_error("Division by zero\n");
+        return narrow(round_divide(__int128(a) * s_one, b, s_rounding));
+    }
+
+    // straight from the digits of the literal, those past the scale are
+    // rounded off
+    static std::int64_t parse_units(std::string_view const literal) {
+        auto const decimal = DecimalLiteral::parse(literal);
+        std::string_view const digits = decimal.digits;
+        std::size_t const dropped =
+            decimal.scale > s_scale ? decimal.scale - s_scale : 0;
+        std::size_t const kept =
+            digits.size() - std::min(digits.size(), dropped);
+
+        __int128 value = 0;
+        for (std::size_t i = 0; i < kept; i++) {
+            value = value * 10 + (digits[i] - '0');
+            if (value > std::numeric_limits<std::int64_t>::max())
+                overflow();
+        }
+
+        if (dropped == 0) {
+            for (unsigned i = decimal.scale; i < s_scale; i++)
+                value *= 10;
+            return narrow(value);
+        }
+
+        // the first dropped digit and whether any after it isn't zero are
+        // all the rounding needs
+        std::string_view const rest = digits.substr(kept);
+        bool const leading = rest.size() == dropped;
+        int const first = leading ? rest[0] - '0' : 0;
+        bool const sticky =
+            rest.find_first_not_of('0', leading ? 1 : 0) != rest.npos;
+        return narrow(
+            round_divide(value * 100 + first * 10 + sticky, 100, s_rounding));
+    }
+
+    // always with all the digits of the scale, 2.50 rather than 2.5
+    static std::string format_units(std::int64_t const units) {
+        bool const negative = units < 0;
+        std::uint64_t const magnitude =
+            negative ? 0 - std::uint64_t(units) : std::uint64_t(units);
+        std::string digits = std::to_string(magnitude);
+        if (s_scale) {
+            if (digits.size() <= s_scale)
+                digits.insert(0, s_scale - digits.size() + 1, '0');
+            digits.insert(digits.size() - s_scale, ".");
+        }
+        return negative ? "-" + digits : digits;
+    }
+
+    // the units of a length n array, a scalar repeated
+    std::shared_ptr<std::vector<std::int64_t> const> spread(
+        std::size_t const n) const {
+        if (array)
+            return array;
+        return std::make_shared<std::vector<std::int64_t> const>(n, units);
+    }
+};
+
+// out = a <op> b on raw units. sums detect overflow from the signs, so
+// their loops stay branch-free and vectorize; products and quotients need
+// int128 and go a lane at a time. false on overflow
+ISA_INLINE bool decimal_apply_body(Instruction::Op const op,
+                                   std::int64_t const* const a,
+                                   std::int64_t const* const b,
+                                   std::int64_t* const out,
+                                   std::size_t const n) {
+    std::uint64_t bad = 0;
+    switch (op) {
+        case Instruction::Add:
+            for (std::size_t i = 0; i < n; i++) {
+                std::uint64_t const x = a[i], y = b[i], r = x + y;
+                out[i] = std::int64_t(r);
+                bad |= (x ^ r) & (y ^ r);
+            }
+            break;
+        case Instruction::Subtract:
+            for (std::size_t i = 0; i < n; i++) {
+                std::uint64_t const x = a[i], y = b[i], r = x - y;
+                out[i] = std::int64_t(r);
+                bad |= (x ^ y) & (x ^ r);
+            }
+            break;
+        case Instruction::Multiply:
+            for (std::size_t i = 0; i < n; i++)
+                out[i] = Decimal::multiply_units(a[i], b[i]);
+            break;
+        default:
+            for (std::size_t i = 0; i < n; i++)
+                out[i] = Decimal::divide_units(a[i], b[i]);
+            break;
+    }
+    return (bad >> 63) == 0;
+}
+
+ISA_DISPATCH(,
+             bool,
+             decimal_apply,
+             (Instruction::Op const op,
+              std::int64_t const* const a,
+              std::int64_t const* const b,
+              std::int64_t* const out,
+              std::size_t const n),
+             (op, a, b, out, n))
+
+template <>
+struct Arithmetic<Decimal> {
+    using T = Decimal;
+
+    static T parse(std::string_view const literal) {
+        return T(Decimal::parse_units(literal));
+    }
+
+    static T make_array(T const* const values, std::size_t const count) {
+        auto array = std::make_shared<std::vector<std::int64_t>>(count);
+        for (std::size_t i = 0; i < count; i++) {
+            if (values[i].array)
+                throw std::runtime_error(
+                    "Nested arrays need the default number mode\n");
+            (*array)[i] = values[i].units;
+        }
+        return T(std::move(array));
+    }
+
+    static T apply(Instruction::Op const op, T const& a, T const& b) {
+        if (not a.array and not b.array) {
+            std::int64_t out = 0;
+            switch (op) {
+                case Instruction::Add:
+                    if (__builtin_add_overflow(a.units, b.units, &out))
+                        Decimal::overflow();
+                    return T(out);
+                case Instruction::Subtract:
+                    if (__builtin_sub_overflow(a.units, b.units, &out))
+                        Decimal::overflow();
+                    return T(out);
+                case Instruction::Multiply:
+                    return T(Decimal::multiply_units(a.units, b.units));
+                default:
+                    return T(Decimal::divide_units(a.units, b.units));
+            }
+        }
+
+        if (a.array and b.array and a.array->size() != b.array->size())
+            throw std::runtime_error("Array lengths differ\n");
+        std::size_t const n = (a.array ? a.array : b.array)->size();
+
+        auto const left = a.spread(n), right = b.spread(n);
+        auto out = std::make_shared<std::vector<std::int64_t>>(n);
+        if (not decimal_apply(op, left->data(), right->data(), out->data(), n))
+            Decimal::overflow();
+        return T(std::move(out));
+    }
+
+    static T add(T const& a, T const& b) {
+        return apply(Instruction::Add, a, b);
+    }
+    static T subtract(T const& a, T const& b) {
+        return apply(Instruction::Subtract, a, b);
+    }
+    static T multiply(T const& a, T const& b) {
+        return apply(Instruction::Multiply, a, b);
+    }
+    static T divide(T const& a, T const& b) {
+        return apply(Instruction::Divide, a, b);
+    }
+
+    static T negate(T const& a) {
+        return apply(Instruction::Subtract, T(0), a);
+    }
+
+    static std::int64_t units(T const& a) {
+        if (a.array)
+            throw std::runtime_error("Expected a number but got an array\n");
+        return a.units;
+    }
+
+    static bool less(T const& a, T const& b) { return units(a) < units(b); }
+    static bool equal(T const& a, T const& b) { return units(a) == units(b); }
+    static bool truthy(T const& a) { return units(a) != 0; }
+    static T from_bool(bool const b) { return T(b ? Decimal::s_one : 0); }
+
+    static std::string format(T const& a) {
+        if (not a.array)
+            return Decimal::format_units(a.units);
+
+        std::string out = "[";
+        for (std::size_t i = 0; i < a.array->size(); i++) {
+            if (i)
+                out += ", ";
+            out += Decimal::format_units((*a.array)[i]);
+        }
+        return out + "]";
+    }
+};
+
+// number types whose Arithmetic can build arrays out of values
+template <typename Ops, typename = void>
+struct HasArrays : std::false_type {};
+template <typename Ops>
+struct HasArrays<Ops,
+                 std::void_t<decltype(Ops::make_array(nullptr, 0))>>
+    : std::true_type {};
+
+template <typename T>
+std::optional<T> BasicVirtualMachine<T>::run(Program const& program) {
+    using Ops = Arithmetic<T>;
+
+    std::vector<T> literals;
+    for (auto const& literal : program.literals)
+        literals.push_back(Ops::parse(literal));
+
+    m_stack.clear();
+    auto const& code = program.code;
+    for (std::size_t pc = 0; pc < code.size();) {
+        auto const [op, operand] = code[pc++];
+
+        switch (op) {
+            case Instruction::Push:
+                m_stack.push_back(literals[operand]);
+                continue;
+
+            case Instruction::Load: {
+                auto const& name = program.names[operand];
+                auto const* const found = m_variables.find(name);
+                if (not found)
+                    throw std::runtime_error("Unknown variable \"" + name +
+                                             "\"\n");
+                m_stack.push_back(*found);
+                continue;
+            }
+
+            case Instruction::Store:
+                slot(program.names[operand]) = pop_value();
+                continue;
+
+            case Instruction::Negate:
+            case Instruction::Not:
+            case Instruction::Truth:
+                m_stack.back() = apply_unary(op, m_stack.back());
+                continue;
+            case Instruction::PushTrue:
+                m_stack.push_back(Ops::from_bool(true));
+                continue;
+            case Instruction::PushFalse:
+                m_stack.push_back(Ops::from_bool(false));
+                continue;
+
+            case Instruction::Jump:
+                pc = operand;
+                continue;
+            case Instruction::JumpIfFalse:
+                if (not Ops::truthy(pop_value()))
+                    pc = operand;
+                continue;
+
+            case Instruction::MakeArray:
+                if constexpr (HasArrays<Ops>::value) {
+                    auto const first = m_stack.end() - operand;
+                    T array = Ops::make_array(
+                        m_stack.data() + m_stack.size() - operand, operand);
+                    m_stack.erase(first, m_stack.end());
+                    m_stack.push_back(std::move(array));
+                    continue;
+                } else {
+                    throw std::runtime_error(
+                        "Arrays need the default number mode\n");
+                }
+
+            default:
+                break;
+        }
+
+        T const b = pop_value();
+        m_stack.back() = apply_binary(op, m_stack.back(), b);
+    }
+
+    if (m_stack.empty())
+        return std::nullopt;
+    return pop_value();
+}
+
+// read-only mapping of a whole file. the column pipelines work straight out
+// of the page cache instead of copying the input through read() buffers
+class MappedFile {
+    int m_fd = -1;
+    char const* m_data = nullptr;
+    std::size_t m_size = 0;
+
+   public:
+    explicit MappedFile(std::string const& path) {
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if (m_fd < 0)
+            throw std::runtime_error("Unable to open \"" + path + "\"\n");
+
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0) {
+            ::close(m_fd);
+            throw std::runtime_error("Unable to stat \"" + path + "\"\n");
+        }
+
+        m_size = st.st_size;
+        if (m_size == 0)
+            return;
+
+        void* const map =
+            ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (map == MAP_FAILED) {
+            ::close(m_fd);
+            throw std::runtime_error("Unable to map \"" + path + "\"\n");
+        }
+
+        m_data = static_cast<char const*>(map);
+
+        // everything reading a mapping walks it front to back once
+        ::madvise(map, m_size, MADV_SEQUENTIAL);
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    ~MappedFile() {
+        if (m_data)
+            ::munmap(const_cast<char*>(m_data), m_size);
+        ::close(m_fd);
+    }
+
+    char const* data() const noexcept { return m_data; }
+    std::size_t size() const noexcept { return m_size; }
+
+    // starts reading [offset, offset + size) in ahead of its use
+    void will_need(std::size_t const offset, std::size_t const size) const {
+        std::size_t const page = ::sysconf(_SC_PAGESIZE);
+        std::size_t const begin = offset / page * page;
+        std::size_t const end = std::min(m_size, offset + size);
+        if (m_data and begin < end)
+            ::madvise(const_cast<char*>(m_data) + begin, end - begin,
+                      MADV_WILLNEED);
+    }
+
+    // drops the pages of [offset, offset + size) from the mapping once
+    // they've been consumed, so inputs bigger than memory stream through a
+    // bounded resident set. only whole pages inside the range are dropped,
+    // the ones shared with a neighbouring range may still be in use, and
+    // it's up to the caller to widen the range once they aren't. the
+    // mapping is read-only, so a dropped page is simply read again if
+    // anything touches it later
+    void release(std::size_t const offset, std::size_t const size) const {
+        std::size_t const page = ::sysconf(_SC_PAGESIZE);
+        std::size_t const begin = (offset + page - 1) / page * page;
+        std::size_t const end =
+            offset + size == m_size ? m_size : (offset + size) / page * page;
+        if (m_data and begin < end)
+            ::madvise(const_cast<char*>(m_data) + begin, end - begin,
+                      MADV_DONTNEED);
+    }
+};
+
+class FileWriter {
+    int m_fd;
+    bool m_owned;
+
+   public:
+    // an empty path writes to stdout
+    explicit FileWriter(std::string const& path) {
+        if (path.empty()) {
+            m_fd = STDOUT_FILENO;
+            m_owned = false;
+            return;
+        }
+
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+            throw std::runtime_error("Unable to create \"" + path + "\"\n");
+        m_owned = true;
+    }
+
+    FileWriter(FileWriter const&) = delete;
+    FileWriter& operator=(FileWriter const&) = delete;
+
+    ~FileWriter() {
+        if (m_owned)
+            ::close(m_fd);
+    }
+
+    void write(std::string_view data) {
+        while (not data.empty()) {
+            auto const written = ::write(m_fd, data.data(), data.size());
+            if (written < 0)
+                throw std::runtime_error("Write to output failed\n");
+            data.remove_prefix(written);
+        }
+    }
+};
+
+// bitmask of the ',' and '\n' among the 64 bytes at `p`, one clone per isa
+std::uint64_t delimiters_sse2(char const* const p) {
+#if defined(__SSE2__)
+    std::uint64_t mask = 0;
+    for (unsigned i = 0; i < 64; i += 16) {
+        __m128i const bytes =
+            _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i));
+        __m128i const hits =
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(',')),
+                         _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+        mask |= std::uint64_t(unsigned(_mm_movemask_epi8(hits))) << i;
+    }
+    return mask;
+#else
+    std::uint64_t mask = 0;
+    for (unsigned i = 0; i < 64; i++) {
+        if (p[i] == ',' or p[i] == '\n')
+            mask |= std::uint64_t(1) << i;
+    }
+    return mask;
+#endif
+}
+
+#if defined(CALC_ISA_CLONES)
+ISA_AVX2 std::uint64_t delimiters_avx2(char const* const p) {
+    std::uint64_t mask = 0;
+    for (unsigned i = 0; i < 64; i += 32) {
+        __m256i const bytes =
+            _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + i));
+        __m256i const hits =
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(',')),
+                            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+        mask |= std::uint64_t(unsigned(_mm256_movemask_epi8(hits))) << i;
+    }
+    return mask;
+}
+
+ISA_AVX512 std::uint64_t delimiters_avx512(char const* const p) {
+    __m512i const bytes = _mm512_loadu_si512(p);
+    return _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8(',')) |
+           _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('\n'));
+}
+
+std::uint64_t (*const kDelimiters[])(char const*) = {
+    delimiters_sse2,
+    delimiters_avx2,
+    delimiters_avx512,
+};
+#else
+std::uint64_t (*const kDelimiters[])(char const*) = {
+    delimiters_sse2,
+    delimiters_sse2,
+    delimiters_sse2,
+};
+#endif
+
+// yields the position of every ',' and '\n' in a buffer, in order. the
+// buffer is classified 64 bytes at a time into a bitmask of delimiters, so
+// short numeric fields cost a couple of bit operations rather than a
+// byte-by-byte loop
+class DelimiterScanner {
+    static constexpr std::ptrdiff_t kBlock = 64;
+
+    char const* m_block;
+    char const* m_end;
+    std::uint64_t m_mask = 0;
+    std::uint64_t (*m_classify)(char const*) = kDelimiters[int(g_isa)];
+
+    void load() {
+        if (m_end - m_block >= kBlock) {
+            m_mask = m_classify(m_block);
+            return;
+        }
+
+        m_mask = 0;
+        for (unsigned i = 0; i < kBlock and m_block + i < m_end; i++) {
+            if (m_block[i] == ',' or m_block[i] == '\n')
+                m_mask |= std::uint64_t(1) << i;
+        }
+    }
+
+   public:
+    DelimiterScanner(char const* begin, char const* end)
+        : m_block(begin), m_end(end) {
+        if (m_block < m_end)
+            load();
+    }
+
+    // returns `end` once the buffer is exhausted
+    char const* next() {
+        while (m_mask == 0) {
+            m_block += kBlock;
+            if (m_block >= m_end)
+                return m_end;
+            load();
+        }
+
+        unsigned const bit = __builtin_ctzll(m_mask);
+        m_mask &= m_mask - 1;
+        return m_block + bit;
+    }
+};
+
+std::string_view trim_field(char const* begin, char const* end) {
+    while (begin < end and (*begin == ' ' or *begin == '\t'))
+        begin++;
+    while (end > begin and (end[-1] == ' ' or end[-1] == '\t' or
+                            end[-1] == '\r'))
+        end--;
+    if (end - begin >= 2 and *begin == '"' and end[-1] == '"') {
+        begin++;
+        end--;
+    }
+    return std::string_view(begin, end - begin);
+}
+
+// empty fields read as NaN so a missing value doesn't abort a whole run
+template <typename T>
+T parse_field(std::string_view field) {
+    if (field.empty())
+        return std::numeric_limits<T>::quiet_NaN();
+    if (field.front() == '+')
+        field.remove_prefix(1);
+
+    T value;
+    auto const [ptr, ec] =
+        std::from_chars(field.data(), field.data() + field.size(), value);
+    if (ec != std::errc() or ptr != field.data() + field.size())
+        throw std::runtime_error("Invalid number \"" + std::string(field) +
+                                 "\" in input\n");
+    return value;
+}
+
+// the tightest doubles around the text of a field. plain decimals are
+// checked digit by digit, exponents get a step on either side
+template <>
+Interval parse_field<Interval>(std::string_view field) {
+    double const r = parse_field<double>(field);
+    if (not std::isfinite(r))
+        return Interval(r);
+
+    bool const negative = field.front() == '-';
+    if (negative or field.front() == '+')
+        field.remove_prefix(1);
+    if (field.find_first_not_of("0123456789.") != std::string_view::npos)
+        return {Interval::down(r), Interval::up(r)};
+    if (field.find('.') == std::string_view::npos and std::abs(r) < 0x1p53)
+        return Interval(r);
+
+    auto const magnitude = Interval::parse(field);
+    return negative ? -magnitude : magnitude;
+}
+
+// shortest text that reads back as the same value of its type
+template <typename T>
+void append_number(std::string& out, T const value) {
+    char buf[32];
+    auto const res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, res.ptr);
+}
+
+// an interval is two fields, its bounds
+inline void append_number(std::string& out, Interval const& value) {
+    append_number(out, value.lo);
+    out += ',';
+    append_number(out, value.hi);
+}
+
+// the columns results of type T are written as. intervals take two, named
+// after the result with _lo and _hi
+template <typename T>
+std::vector<std::string> output_columns(std::vector<std::string> const& names) {
+    if constexpr (not std::is_same_v<T, Interval>) {
+        return names;
+    } else {
+        std::vector<std::string> out;
+        for (auto const& name : names) {
+            out.push_back(name + "_lo");
+            out.push_back(name + "_hi");
+        }
+        return out;
+    }
+}
+
+// a set of `--expr` statements compiled against the columns of one input,
+// evaluated in precision T
+template <typename T>
+class ColumnProgram {
+    ColumnSchema m_schema;
+    unsigned m_inputs;
+    std::unique_ptr<Node> m_where;
+    std::vector<std::unique_ptr<Node>> m_exprs;
+    std::vector<std::string> m_output_names;
+
+    // selection vector of the rows passing `m_where`, and the gathered
+    // values of those rows for every column the program reads
+    std::vector<std::uint32_t> m_selection;
+    std::vector<std::vector<T>> m_selected;
+
+    std::unique_ptr<Node> compile(std::string const& source,
+                                  VirtualMachine& vm) {
+        CompileContext ctx = {
+            .src = source,
+        };
+
+        auto const toks = tokenize(source);
+        auto expr = Parser::parse(ctx, toks);
+        PhaseScope const phase(Phase::Bind);
+        expr->bind(m_schema, vm);
+        return expr;
+    }
 
-class BinaryNode : public Node {
    public:
-    enum Action {
-        Add,
-        Subtract,
-        Multiply,
-        Divide,
+    // `where` may be empty, in which case every row is kept
+    ColumnProgram(std::vector<std::string> const& columns,
+                  std::string const& where,
+                  std::vector<std::string> const& sources,
+                  VirtualMachine& vm)
+        : m_inputs(columns.size()) {
+        for (auto const& column : columns)
+            m_schema.add(column);
+
+        if (not where.empty()) {
+            m_where = compile(where, vm);
+            m_selection.resize(kBlockRows);
+        }
+
+        for (auto const& source : sources) {
+            auto expr = compile(source, vm);
+
+            auto const* assignment =
+                dynamic_cast<AssignmentNode const*>(expr.get());
+            m_output_names.push_back(assignment ? assignment->name()
+                                                : source);
+
+            // every output becomes a column the following expressions can
+            // read
+            m_schema.add(m_output_names.back());
+            m_exprs.push_back(std::move(expr));
+        }
+    }
+
+    unsigned inputs() const noexcept { return m_inputs; }
+
+    // makes the sources provide every input column, not just the ones the
+    // expressions need
+    void read_all() { m_schema.use_all(); }
+
+    bool reads(unsigned column) const noexcept {
+        return m_schema.used(column);
+    }
+
+    std::vector<std::string> const& output_names() const noexcept {
+        return m_output_names;
+    }
+
+    // narrows the frame down to the rows passing the where clause. the
+    // predicate is evaluated for the whole block with packed compares, then
+    // turned into a selection vector without branching on each row
+    void filter(BlockFrame<T>& frame) {
+        if (not m_where)
+            return;
+
+        T* const mask = frame.scratch.acquire();
+        m_where->execute_block(frame, mask);
+
+        std::size_t selected = 0;
+        for (std::size_t i = 0; i < frame.rows; i++) {
+            m_selection[selected] = i;
+            selected += row_truthy(mask[i]);
+        }
+        frame.scratch.release();
+
+        if (selected == frame.rows)
+            return;
+
+        m_selected.resize(m_inputs);
+        for (unsigned c = 0; c < m_inputs; c++) {
+            if (not frame.columns[c])
+                continue;
+
+            auto& gathered = m_selected[c];
+            gathered.resize(kBlockRows);
+            for (std::size_t i = 0; i < selected; i++)
+                gathered[i] = frame.columns[c][m_selection[i]];
+            frame.columns[c] = gathered.data();
+        }
+        frame.rows = selected;
+    }
+
+    // `frame.columns` holds the input columns on entry, and gets the slots
+    // of the outputs appended as they're computed
+    void evaluate(BlockFrame<T>& frame, std::vector<T*> const& outputs) {
+        frame.columns.resize(m_inputs);
+        for (unsigned i = 0; i < m_exprs.size(); i++) {
+            m_exprs[i]->execute_block(frame, outputs[i]);
+            frame.columns.push_back(outputs[i]);
+        }
+    }
+};
+
+// runs `work(chunk, worker)` for every chunk index on a pool of threads and
+// hands each result to `emit` on the calling thread, in chunk order. only a
+// bounded window of chunks is in flight at once, so huge inputs don't pile up in
+// memory while the writer catches up
+template <typename Result, typename Work, typename Emit>
+void run_ordered_chunks(std::size_t const count,
+                        unsigned const threads,
+                        Work&& work,
+                        Emit&& emit) {
+    std::size_t const window = std::size_t(threads) * 2;
+    std::vector<std::optional<Result>> slots(window);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::size_t next = 0, emitted = 0;
+    std::exception_ptr error;
+
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (not error)
+            error = e;
+        cv.notify_all();
+    };
+
+    Phase const phase = g_phase;
+    auto worker = [&](unsigned const worker_idx) {
+        g_phase = phase;
+        TraceScope const trace("worker");
+        for (;;) {
+            std::size_t idx;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                TraceScope const wait("wait");
+                cv.wait(lock, [&] {
+                    return error or next >= count or next < emitted + window;
+                });
+                if (error or next >= count)
+                    return;
+                idx = next++;
+            }
+
+            try {
+                TraceScope const chunk("chunk");
+                Result result = work(idx, worker_idx);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                slots[idx % window] = std::move(result);
+                cv.notify_all();
+            } catch (...) {
+                fail(std::current_exception());
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker, i);
+
+    while (emitted < count) {
+        std::optional<Result> ready;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            TraceScope const wait("wait");
+            cv.wait(lock, [&] {
+                return error or slots[emitted % window].has_value();
+            });
+            if (error)
+                break;
+            ready = std::move(slots[emitted % window]);
+            slots[emitted % window].reset();
+        }
+
+        try {
+            TraceScope const trace("emit");
+            emit(*ready);
+        } catch (...) {
+            fail(std::current_exception());
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        emitted += 1;
+        cv.notify_all();
+    }
+
+    for (auto& thread : pool)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// number types the repl can run in besides the default, which is double
+// with arrays and builtins
+struct Mode {
+    char const* name;
+    void (*run)();
+};
+
+struct Options {
+    std::string csv_path;
+    std::string manifest_path;
+    std::string out_path;
+    std::string out_dir;
+    std::string where;
+    std::string aggs;
+    std::string group_by;
+    std::vector<std::string> exprs;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    Isa isa = g_detected_isa;
+    // --precision f32 evaluates --expr and --agg in float
+    bool single = false;
+    // repl number type other than the default, from kModes
+    Mode const* mode = nullptr;
+    // --mode interval with --expr or --agg runs the column engine on
+    // intervals
+    bool interval = false;
+    // significant digits of --mode bigfloat, 0 keeps the default
+    unsigned digits = 0;
+    // count allocations per phase and report them at exit
+    bool mem = false;
+    // hardware counters per phase, reported at exit
+    bool perf = false;
+    // where --trace writes the timeline, empty for none
+    std::string trace_path;
+    // decimal places and rounding of --mode decimal
+    std::optional<unsigned> scale;
+    std::optional<Rounding> rounding;
+};
+
+// where the rows of a column run come from, as values of type T. the input
+// is cut into chunks that can be read independently, one worker each
+template <typename T>
+class ColumnSource {
+   public:
+    virtual std::vector<std::string> const& columns() const noexcept = 0;
+    virtual std::size_t chunks() const noexcept = 0;
+
+    // fills frame.columns/frame.rows with consecutive blocks of chunk `idx`
+    // and calls `consume` after each. only the columns `program` reads
+    // have to be provided
+    virtual void read_chunk(std::size_t idx,
+                            ColumnProgram<T> const& program,
+                            BlockFrame<T>& frame,
+                            std::function<void()> const& consume) const = 0;
+
+    // readahead and eviction hints for chunk `idx` of a mapped input
+    virtual void prefetch(std::size_t idx) const = 0;
+    virtual void release(std::size_t idx) const = 0;
+
+    virtual ~ColumnSource() = default;
+};
+
+// where the results go. `append` runs on the workers and turns a block of
+// results into bytes, one string per output stream, and `write` stores a
+// finished chunk of those on the calling thread, in order
+template <typename T>
+class ColumnSink {
+   public:
+    virtual unsigned streams() const noexcept = 0;
+    virtual void append(std::vector<T*> const& results,
+                        std::size_t rows,
+                        std::vector<std::string>& chunk) const = 0;
+    virtual void write(std::vector<std::string> const& chunk) = 0;
+    virtual void finish() {}
+
+    virtual ~ColumnSink() = default;
+};
+
+// target size of the pieces an input is split into. csv chunks are cut at
+// the next line break, so workers never see a partial row
+constexpr std::size_t kChunkBytes = 4 << 20;
+
+template <typename T>
+class CsvSource : public ColumnSource<T> {
+    MappedFile m_file;
+    std::vector<std::string> m_columns;
+    std::vector<char const*> m_bounds;
+
+    // chunks released so far. chunks end on a line, not a page, so the
+    // page across each bound is shared, and whichever of the two chunks
+    // finishes last drops it
+    mutable std::mutex m_release_mutex;
+    mutable std::vector<bool> m_released;
+
+   public:
+    explicit CsvSource(std::string const& path) : m_file(path) {
+        char const* const data = m_file.data();
+        char const* const end = data + m_file.size();
+
+        char const* header_end =
+            data ? static_cast<char const*>(
+                       std::memchr(data, '\n', m_file.size()))
+                 : nullptr;
+        if (not header_end)
+            header_end = end;
+
+        for (char const* field = data; field <= header_end;) {
+            char const* delim = std::find(field, header_end, ',');
+            m_columns.emplace_back(trim_field(field, delim));
+            field = delim + 1;
+        }
+
+        m_bounds.push_back(header_end == end ? end : header_end + 1);
+        while (m_bounds.back() < end) {
+            char const* cut =
+                m_bounds.back() +
+                std::min<std::size_t>(kChunkBytes, end - m_bounds.back());
+            if (cut < end) {
+                char const* const eol = static_cast<char const*>(
+                    std::memchr(cut, '\n', end - cut));
+                cut = eol ? eol + 1 : end;
+            }
+            m_bounds.push_back(cut);
+        }
+        m_released.resize(chunks());
+    }
+
+    std::vector<std::string> const& columns() const noexcept override {
+        return m_columns;
+    }
+
+    std::size_t chunks() const noexcept override {
+        return m_bounds.size() - 1;
+    }
+
+    void prefetch(std::size_t const idx) const override {
+        m_file.will_need(m_bounds[idx] - m_file.data(),
+                         m_bounds[idx + 1] - m_bounds[idx]);
+    }
+
+    void release(std::size_t const idx) const override {
+        std::size_t const page = ::sysconf(_SC_PAGESIZE);
+        auto const offset = [&](std::size_t const bound) -> std::size_t {
+            return m_bounds[bound] - m_file.data();
+        };
+        std::size_t begin = offset(idx);
+        std::size_t end = offset(idx + 1);
+        std::size_t const first = begin / page * page;
+        std::size_t const last =
+            std::min(m_file.size(), (end + page - 1) / page * page);
+
+        {
+            std::lock_guard<std::mutex> const lock(m_release_mutex);
+            m_released[idx] = true;
+
+            // the first page goes once every chunk reaching into it from
+            // the left is done. the header was read up front
+            std::size_t before = idx;
+            while (before > 0 and offset(before) > first and
+                   m_released[before - 1])
+                before--;
+            if (before == 0 or offset(before) <= first)
+                begin = first;
+
+            // and the last once every chunk starting in it is
+            std::size_t after = idx + 1;
+            while (after < chunks() and offset(after) < last and
+                   m_released[after])
+                after++;
+            if (after == chunks() or offset(after) >= last)
+                end = last;
+        }
+
+        m_file.release(begin, end - begin);
+    }
+
+    void read_chunk(std::size_t const idx,
+                    ColumnProgram<T> const& program,
+                    BlockFrame<T>& frame,
+                    std::function<void()> const& consume) const override {
+        char const* const begin = m_bounds[idx];
+        char const* const end = m_bounds[idx + 1];
+        unsigned const inputs = m_columns.size();
+
+        std::vector<std::vector<T>> columns(inputs);
+        for (unsigned c = 0; c < inputs; c++) {
+            if (program.reads(c))
+                columns[c].resize(kBlockRows);
+        }
+
+        auto flush = [&] {
+            frame.columns.clear();
+            for (auto const& column : columns)
+                frame.columns.push_back(column.empty() ? nullptr
+                                                       : column.data());
+            consume();
+            frame.rows = 0;
+        };
+
+        frame.rows = 0;
+        DelimiterScanner scanner(begin, end);
+        char const* field = begin;
+        while (field < end) {
+            // skip blank lines
+            if (*field == '\n' or
+                (*field == '\r' and field + 1 < end and field[1] == '\n')) {
+                field = scanner.next() + 1;
+                continue;
+            }
+
+            for (unsigned c = 0; c < inputs; c++) {
+                char const* const delim = scanner.next();
+                bool const last = c + 1 == inputs;
+
+                if (delim == end or *delim == '\n') {
+                    if (not last)
+                        throw std::runtime_error("Row has too few fields\n");
+                } else if (last) {
+                    throw std::runtime_error("Row has too many fields\n");
+                }
+
+                if (program.reads(c))
+                    columns[c][frame.rows] =
+                        parse_field<T>(trim_field(field, delim));
+                field = delim + 1;
+            }
+
+            if (++frame.rows == kBlockRows)
+                flush();
+        }
+
+        if (frame.rows > 0)
+            flush();
+    }
+};
+
+// raw little-endian column files described by a sidecar manifest, one
+// column per line:
+//
+//     # name type file
+//     price f64 price.bin
+//     qty   i64 qty.bin
+//
+// types are f64, f32 and i64, files are relative to the manifest. columns
+// of the run's own precision are handed to the engine straight out of the
+// mapping, the others are converted a block at a time
+template <typename T>
+class BinarySource : public ColumnSource<T> {
+   public:
+    enum class Type {
+        F64,
+        F32,
+        I64,
+    };
+
+   private:
+    struct Column {
+        Type type;
+        std::unique_ptr<MappedFile> file;
+    };
+
+    static constexpr std::size_t kRowsPerChunk = kChunkBytes / sizeof(double);
+
+    std::vector<std::string> m_columns;
+    std::vector<Column> m_files;
+    std::size_t m_rows = 0;
+
+   public:
+    static std::size_t width(Type const type) noexcept {
+        return type == Type::F32 ? 4 : 8;
+    }
+
+    // whether a column of `type` needs no conversion. intervals always do
+    static constexpr bool native(Type const type) noexcept {
+        if constexpr (std::is_same_v<T, float>)
+            return type == Type::F32;
+        else
+            return std::is_same_v<T, double> and type == Type::F64;
+    }
+
+    template <typename From>
+    static void convert(From const* src, std::size_t const rows, T* dst) {
+        for (std::size_t i = 0; i < rows; i++) {
+            if constexpr (kRowwise<T> and std::is_same_v<From, std::int64_t>)
+                dst[i] = Interval::enclose(src[i]);
+            else
+                dst[i] = T(src[i]);
+        }
+    }
+
+    explicit BinarySource(std::string const& manifest_path) {
+        MappedFile manifest(manifest_path);
+        auto const slash = manifest_path.rfind('/');
+        std::string const dir = slash == std::string::npos
+                                    ? std::string()
+                                    : manifest_path.substr(0, slash + 1);
+
+        std::string_view text(manifest.data(), manifest.size());
+        while (not text.empty()) {
+            auto const eol = text.find('\n');
+            auto line = text.substr(0, eol);
+            text.remove_prefix(eol == std::string_view::npos ? text.size()
+                                                             : eol + 1);
+
+            std::vector<std::string_view> words;
+            for (;;) {
+                auto const start = line.find_first_not_of(" \t\r");
+                if (start == std::string_view::npos or line[start] == '#')
+                    break;
+                line.remove_prefix(start);
+                auto const stop = line.find_first_of(" \t\r");
+                words.push_back(line.substr(0, stop));
+                line.remove_prefix(stop == std::string_view::npos ? line.size()
+                                                                  : stop);
+            }
+
+            if (words.empty())
+                continue;
+            if (words.size() != 3)
+                throw std::runtime_error(
+                    "Expected \"name type file\" in manifest\n");
+
+            Type type;
+            if (words[1] == "f64")
+                type = Type::F64;
+            else if (words[1] == "f32")
+                type = Type::F32;
+            else if (words[1] == "i64")
+                type = Type::I64;
+            else
+                throw std::runtime_error("Unknown column type \"" +
+                                         std::string(words[1]) + "\"\n");
+
+            std::string path(words[2]);
+            if (path.front() != '/')
+                path = dir + path;
+
+            auto file = std::make_unique<MappedFile>(path);
+            if (file->size() % width(type) != 0)
+                throw std::runtime_error("Size of \"" + path +
+                                         "\" isn't a multiple of its type\n");
+
+            std::size_t const rows = file->size() / width(type);
+            if (not m_files.empty() and rows != m_rows)
+                throw std::runtime_error(
+                    "Columns in manifest differ in length\n");
+            m_rows = rows;
+
+            m_columns.emplace_back(words[0]);
+            m_files.push_back(Column{.type = type, .file = std::move(file)});
+        }
+
+        if (m_columns.empty())
+            throw std::runtime_error("Manifest lists no columns\n");
+    }
+
+    std::vector<std::string> const& columns() const noexcept override {
+        return m_columns;
+    }
+
+    std::size_t chunks() const noexcept override {
+        return (m_rows + kRowsPerChunk - 1) / kRowsPerChunk;
+    }
+
+    void prefetch(std::size_t const idx) const override {
+        for (auto const& column : m_files) {
+            std::size_t const size = kRowsPerChunk * width(column.type);
+            column.file->will_need(idx * size, size);
+        }
+    }
+
+    void release(std::size_t const idx) const override {
+        for (auto const& column : m_files) {
+            std::size_t const size = kRowsPerChunk * width(column.type);
+            column.file->release(idx * size,
+                                 std::min(size, column.file->size() -
+                                                    idx * size));
+        }
+    }
+
+    void read_chunk(std::size_t const idx,
+                    ColumnProgram<T> const& program,
+                    BlockFrame<T>& frame,
+                    std::function<void()> const& consume) const override {
+        std::size_t const begin = idx * kRowsPerChunk;
+        std::size_t const end = std::min(m_rows, begin + kRowsPerChunk);
+
+        std::vector<std::vector<T>> converted(m_files.size());
+        for (unsigned c = 0; c < m_files.size(); c++) {
+            if (program.reads(c) and not native(m_files[c].type))
+                converted[c].resize(kBlockRows);
+        }
+
+        for (std::size_t row = begin; row < end; row += kBlockRows) {
+            frame.rows = std::min(kBlockRows, end - row);
+            frame.columns.assign(m_files.size(), nullptr);
+
+            for (unsigned c = 0; c < m_files.size(); c++) {
+                if (not program.reads(c))
+                    continue;
+
+                char const* const data = m_files[c].file->data();
+                if (native(m_files[c].type)) {
+                    frame.columns[c] = reinterpret_cast<T const*>(data) + row;
+                    continue;
+                }
+
+                switch (m_files[c].type) {
+                    case Type::F64:
+                        convert(reinterpret_cast<double const*>(data) + row,
+                                frame.rows, converted[c].data());
+                        break;
+                    case Type::F32:
+                        convert(reinterpret_cast<float const*>(data) + row,
+                                frame.rows, converted[c].data());
+                        break;
+                    case Type::I64:
+                        convert(
+                            reinterpret_cast<std::int64_t const*>(data) + row,
+                            frame.rows, converted[c].data());
+                        break;
+                }
+                frame.columns[c] = converted[c].data();
+            }
+
+            consume();
+        }
+    }
+};
+
+template <typename T>
+class CsvSink : public ColumnSink<T> {
+    FileWriter m_writer;
+    unsigned m_outputs;
+
+   public:
+    CsvSink(std::string const& path, std::vector<std::string> const& names)
+        : m_writer(path), m_outputs(names.size()) {
+        std::string header;
+        for (auto const& name : output_columns<T>(names)) {
+            if (not header.empty())
+                header += ',';
+            header += name;
+        }
+        m_writer.write(header + '\n');
+    }
+
+    unsigned streams() const noexcept override { return 1; }
+
+    void append(std::vector<T*> const& results,
+                std::size_t const rows,
+                std::vector<std::string>& chunk) const override {
+        std::string& out = chunk.front();
+        for (std::size_t row = 0; row < rows; row++) {
+            for (unsigned c = 0; c < m_outputs; c++) {
+                if (c != 0)
+                    out += ',';
+                append_number(out, results[c][row]);
+            }
+            out += '\n';
+        }
+    }
+
+    void write(std::vector<std::string> const& chunk) override {
+        m_writer.write(chunk.front());
+    }
+};
+
+// buffers output in page aligned blocks and only ever writes whole blocks,
+// so the file can be opened with O_DIRECT and bypass the page cache. falls
+// back to buffered writes on filesystems that refuse O_DIRECT
+class DirectWriter {
+    static constexpr std::size_t kAlign = 4096;
+    static constexpr std::size_t kBufferBytes = 1 << 20;
+
+    int m_fd;
+    char* m_buffer = nullptr;
+    std::size_t m_used = 0;
+
+    void write_all(char const* data, std::size_t size) {
+        while (size > 0) {
+            auto const written = ::write(m_fd, data, size);
+            if (written < 0)
+                throw std::runtime_error("Write to output failed\n");
+            data += written;
+            size -= written;
+        }
+    }
+
+   public:
+    explicit DirectWriter(std::string const& path) {
+        int const flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_DIRECT)
+        m_fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if (m_fd < 0 and errno == EINVAL)
+#endif
+            m_fd = ::open(path.c_str(), flags, 0644);
+        if (m_fd < 0)
+            throw std::runtime_error("Unable to create \"" + path + "\"\n");
+
+        void* buffer;
+        if (::posix_memalign(&buffer, kAlign, kBufferBytes) != 0) {
+            ::close(m_fd);
+            throw std::bad_alloc();
+        }
+        m_buffer = static_cast<char*>(buffer);
+    }
+
+    DirectWriter(DirectWriter const&) = delete;
+    DirectWriter& operator=(DirectWriter const&) = delete;
+
+    ~DirectWriter() {
+        std::free(m_buffer);
+        ::close(m_fd);
+    }
+
+    void write(std::string_view data) {
+        while (not data.empty()) {
+            std::size_t const take =
+                std::min(data.size(), kBufferBytes - m_used);
+            std::memcpy(m_buffer + m_used, data.data(), take);
+            m_used += take;
+            data.remove_prefix(take);
+
+            if (m_used == kBufferBytes) {
+                write_all(m_buffer, m_used);
+                m_used = 0;
+            }
+        }
+    }
+
+    // writes the unaligned tail. O_DIRECT is dropped for it, since the
+    // kernel won't take a partial block
+    void finish() {
+        if (m_used == 0)
+            return;
+#if defined(O_DIRECT)
+        ::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+#endif
+        write_all(m_buffer, m_used);
+        m_used = 0;
+    }
+};
+
+// writes every output as a raw f64 (or f32) column next to a manifest
+// describing them, so the results can be fed straight back in with --columns.
+// intervals are two f64 columns, name_lo and name_hi
+template <typename T>
+class BinarySink : public ColumnSink<T> {
+    std::vector<std::unique_ptr<DirectWriter>> m_writers;
+
+   public:
+    BinarySink(std::string const& dir, std::vector<std::string> const& names) {
+        for (auto const& name : names) {
+            bool const valid =
+                not name.empty() and isalpha(name.front()) and
+                std::all_of(name.begin(), name.end(),
+                            [](unsigned char c) {
+                                return isalnum(c) or c == '_';
+                            });
+            if (not valid)
+                throw std::runtime_error(
+                    "Binary output needs named expressions (name = ...)\n");
+        }
+
+        if (::mkdir(dir.c_str(), 0755) != 0 and errno != EEXIST)
+            throw std::runtime_error("Unable to create \"" + dir + "\"\n");
+
+        std::string const type = std::is_same_v<T, float> ? "f32" : "f64";
+        std::string manifest = "# name type file\n";
+        for (auto const& name : output_columns<T>(names)) {
+            std::string const file = name + "." + type;
+            m_writers.push_back(std::make_unique<DirectWriter>(dir + "/" + file));
+            manifest += name + " " + type + " " + file + "\n";
+        }
+
+        FileWriter(dir + "/manifest").write(manifest);
+    }
+
+    unsigned streams() const noexcept override { return m_writers.size(); }
+
+    void append(std::vector<T*> const& results,
+                std::size_t const rows,
+                std::vector<std::string>& chunk) const override {
+        if constexpr (kRowwise<T>) {
+            for (unsigned c = 0; c < results.size(); c++) {
+                std::string& lo = chunk[2 * c];
+                std::string& hi = chunk[2 * c + 1];
+                for (std::size_t row = 0; row < rows; row++) {
+                    Interval const& value = results[c][row];
+                    lo.append(reinterpret_cast<char const*>(&value.lo),
+                              sizeof(double));
+                    hi.append(reinterpret_cast<char const*>(&value.hi),
+                              sizeof(double));
+                }
+            }
+        } else {
+            for (unsigned c = 0; c < chunk.size(); c++)
+                chunk[c].append(reinterpret_cast<char const*>(results[c]),
+                                rows * sizeof(T));
+        }
+    }
+
+    void write(std::vector<std::string> const& chunk) override {
+        for (unsigned c = 0; c < chunk.size(); c++)
+            m_writers[c]->write(chunk[c]);
+    }
+
+    void finish() override {
+        for (auto& writer : m_writers)
+            writer->finish();
+    }
+};
+
+template <typename T>
+std::unique_ptr<ColumnSource<T>> open_source(Options const& options) {
+    if (not options.csv_path.empty())
+        return std::make_unique<CsvSource<T>>(options.csv_path);
+    return std::make_unique<BinarySource<T>>(options.manifest_path);
+}
+
+// reads chunk `idx` of `source` block by block. the pool works on roughly
+// `threads` consecutive chunks at a time, so each chunk asks for the one
+// that many positions ahead of it and hands its own pages back when done
+template <typename T>
+void stream_chunk(ColumnSource<T> const& source,
+                  std::size_t const idx,
+                  unsigned const threads,
+                  ColumnProgram<T> const& program,
+                  BlockFrame<T>& frame,
+                  std::function<void()> const& consume) {
+    if (idx + threads < source.chunks())
+        source.prefetch(idx + threads);
+
+    source.read_chunk(idx, program, frame, consume);
+    source.release(idx);
+}
+
+template <typename T>
+int run_columns(Options const& options, VirtualMachine& vm) {
+    auto const source = open_source<T>(options);
+
+    // every worker gets its own copy of the program, since the nodes are
+    // not meant to be shared across threads
+    std::vector<std::unique_ptr<ColumnProgram<T>>> programs;
+    for (unsigned i = 0; i < options.threads; i++)
+        programs.push_back(std::make_unique<ColumnProgram<T>>(
+            source->columns(), options.where, options.exprs, vm));
+
+    auto const& names = programs.front()->output_names();
+    std::unique_ptr<ColumnSink<T>> sink;
+    if (not options.out_dir.empty())
+        sink = std::make_unique<BinarySink<T>>(options.out_dir, names);
+    else
+        sink = std::make_unique<CsvSink<T>>(options.out_path, names);
+
+    std::size_t const chunks = source->chunks();
+    for (std::size_t idx = 0; idx < std::min<std::size_t>(chunks,
+                                                          options.threads);
+         idx++)
+        source->prefetch(idx);
+
+    run_ordered_chunks<std::vector<std::string>>(
+        chunks, options.threads,
+        [&](std::size_t idx, unsigned worker) {
+            ColumnProgram<T>& program = *programs[worker];
+
+            std::vector<std::vector<T>> results(names.size(),
+                                                std::vector<T>(kBlockRows));
+            std::vector<T*> result_ptrs;
+            for (auto& result : results)
+                result_ptrs.push_back(result.data());
+
+            BlockScratch<T> scratch;
+            BlockFrame<T> frame{.columns = {}, .rows = 0, .scratch = scratch};
+            std::vector<std::string> chunk(sink->streams());
+
+            stream_chunk(*source, idx, options.threads, program, frame, [&] {
+                program.filter(frame);
+                program.evaluate(frame, result_ptrs);
+                sink->append(result_ptrs, frame.rows, chunk);
+            });
+
+            return chunk;
+        },
+        [&](std::vector<std::string> const& chunk) { sink->write(chunk); });
+
+    sink->finish();
+    return 0;
+}
+
+struct AggregateSpec {
+    enum Function {
+        Sum,
+        Count,
+        Mean,
+        Min,
+        Max,
+    };
+
+    Function function;
+    // as written, used as the output column name
+    std::string label;
+    // source of the argument expression, empty for count()
+    std::string arg;
+};
+
+// splits `sum(x*y), count(), mean(y)` into its aggregates. the arguments are
+// kept as source so every worker can compile its own copy
+std::vector<AggregateSpec> parse_aggregates(std::string const& src) {
+    CompileContext ctx = {
+        .src = src,
     };
+    auto const toks = tokenize(src);
+
+    std::vector<AggregateSpec> specs;
+    for (unsigned idx = 0;;) {
+        auto const& name = toks[idx];
+        if (name.m_type != Token::Type::Identifier or
+            toks[idx + 1].m_type != Token::Type::LeftParanthesis)
+            throw std::runtime_error(
+                "Expected an aggregate such as sum(expr)\n");
+
+        AggregateSpec spec;
+        auto const function = ctx.get_from_range(name.m_range);
+        if (function == "sum")
+            spec.function = AggregateSpec::Sum;
+        else if (function == "count")
+            spec.function = AggregateSpec::Count;
+        else if (function == "mean")
+            spec.function = AggregateSpec::Mean;
+        else if (function == "min")
+            spec.function = AggregateSpec::Min;
+        else if (function == "max")
+            spec.function = AggregateSpec::Max;
+        else
+            throw std::runtime_error("Unknown aggregate \"" + function +
+                                     "\"\n");
+
+        idx += 2;
+        unsigned const arg_start = idx;
+        for (unsigned depth = 1; depth > 0; idx++) {
+            if (toks[idx].m_type == Token::Type::LeftParanthesis)
+                depth += 1;
+            else if (toks[idx].m_type == Token::Type::RightParanthesis)
+                depth -= 1;
+            else if (toks[idx].m_type == Token::Type::End)
+                throw std::runtime_error("Expected a right-paranthesis\n");
+        }
+
+        auto const& close = toks[idx - 1];
+        spec.arg = ctx.get_from_range(
+            {.start = toks[arg_start].m_range.start,
+             .end = close.m_range.start});
+        spec.label = ctx.get_from_range(
+            {.start = name.m_range.start, .end = close.m_range.end});
+
+        if ((spec.function == AggregateSpec::Count) != spec.arg.empty())
+            throw std::runtime_error(
+                spec.function == AggregateSpec::Count
+                    ? "count() takes no argument\n"
+                    : "Aggregate \"" + function + "\" needs an argument\n");
+        specs.push_back(std::move(spec));
+
+        if (toks[idx].m_type == Token::Type::End)
+            return specs;
+        if (toks[idx].m_type != Token::Type::Comma)
+            throw std::runtime_error("Expected a comma\n");
+        idx += 1;
+    }
+}
+
+// running state of one aggregate. partial states from different workers
+// (or groups) are combined with merge()
+struct Aggregate {
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    std::uint64_t count = 0;
+
+    // four independent accumulators so consecutive adds don't wait on each
+    // other, the compiler won't reassociate floating point sums by itself.
+    // float blocks are accumulated in double all the same
+    template <typename T>
+    void add(T const* values, std::size_t const rows) {
+        double sums[4] = {0, 0, 0, 0};
+        double mins[4] = {min, min, min, min};
+        double maxs[4] = {max, max, max, max};
 
-    BinaryNode(Action action,
-               std::unique_ptr<Node>&& left,
-               std::unique_ptr<Node>&& right)
-        : m_action(action),
-          m_left(std::move(left)),
-          m_right(std::move(right)) {}
+        std::size_t i = 0;
+        for (; i + 4 <= rows; i += 4) {
+            for (unsigned lane = 0; lane < 4; lane++) {
+                double const value = values[i + lane];
+                sums[lane] += value;
+                mins[lane] = value < mins[lane] ? value : mins[lane];
+                maxs[lane] = value > maxs[lane] ? value : maxs[lane];
+            }
+        }
+        for (; i < rows; i++) {
+            sums[0] += values[i];
+            mins[0] = values[i] < mins[0] ? values[i] : mins[0];
+            maxs[0] = values[i] > maxs[0] ? values[i] : maxs[0];
+        }
 
-    void execute(VirtualMachine& vm) override {
-        m_left->execute(vm);
-        m_right->execute(vm);
+        sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+        min = std::min(std::min(mins[0], mins[1]), std::min(mins[2], mins[3]));
+        max = std::max(std::max(maxs[0], maxs[1]), std::max(maxs[2], maxs[3]));
+        count += rows;
+    }
 
-        auto right_val = vm.pop();
-        auto left_val = vm.pop();
+    void add(double const value) {
+        sum += value;
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        count += 1;
+    }
 
-        switch (m_action) {
-            case Add:
-                vm.push(left_val + right_val);
-                break;
+    void merge(Aggregate const& other) {
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        count += other.count;
+    }
 
-            case Subtract:
-                vm.push(left_val - right_val);
-                break;
+    double result(AggregateSpec::Function const function) const {
+        if (count == 0 and function != AggregateSpec::Count and
+            function != AggregateSpec::Sum)
+            return std::numeric_limits<double>::quiet_NaN();
 
-            case Multiply:
-                vm.push(left_val * right_val);
-                break;
+        switch (function) {
+            case AggregateSpec::Sum:
+                return sum;
+            case AggregateSpec::Count:
+                return count;
+            case AggregateSpec::Mean:
+                return sum / count;
+            case AggregateSpec::Min:
+                return min;
+            case AggregateSpec::Max:
+                return max;
+        }
 
-            case Divide:
-                vm.push(left_val / right_val);
-                break;
+        return 0;
+    }
+};
+
+// the same for interval rows. the sum is added up with outward rounding, and
+// min and max keep the smallest and largest bound on either side, so each
+// result encloses the exact one. nan rows count but are left out of min and
+// max, as in Aggregate
+struct IntervalAggregate {
+    Interval sum;
+    Interval min{std::numeric_limits<double>::infinity(),
+                 std::numeric_limits<double>::infinity()};
+    Interval max{-std::numeric_limits<double>::infinity(),
+                 -std::numeric_limits<double>::infinity()};
+    std::uint64_t count = 0;
+
+    void add(Interval const* values, std::size_t const rows) {
+        for (std::size_t i = 0; i < rows; i++)
+            add(values[i]);
+    }
+
+    void add(Interval const& value) {
+        sum = sum + value;
+        if (not value.is_nan()) {
+            min = {std::min(min.lo, value.lo), std::min(min.hi, value.hi)};
+            max = {std::max(max.lo, value.lo), std::max(max.hi, value.hi)};
         }
+        count += 1;
     }
 
-   private:
-    Action m_action;
-    std::unique_ptr<Node> m_left, m_right;
-};
+    void merge(IntervalAggregate const& other) {
+        sum = sum + other.sum;
+        min = {std::min(min.lo, other.min.lo), std::min(min.hi, other.min.hi)};
+        max = {std::max(max.lo, other.max.lo), std::max(max.hi, other.max.hi)};
+        count += other.count;
+    }
 
-class Parser {
-    CompileContext const& m_ctx;
+    Interval result(AggregateSpec::Function const function) const {
+        if (count == 0 and function != AggregateSpec::Count and
+            function != AggregateSpec::Sum)
+            return Interval(std::numeric_limits<double>::quiet_NaN());
 
-    std::vector<Token> const& m_toks;
-    unsigned m_idx;
+        switch (function) {
+            case AggregateSpec::Sum:
+                return sum;
+            case AggregateSpec::Count:
+                return Interval(double(count));
+            case AggregateSpec::Mean:
+                return sum / Interval(double(count));
+            case AggregateSpec::Min:
+                return min;
+            case AggregateSpec::Max:
+                return max;
+        }
 
-    Parser(CompileContext const& ctx, std::vector<Token> const& toks)
-        : m_ctx(ctx), m_toks(toks), m_idx(0) {}
+        return {};
+    }
+};
 
-    std::unique_ptr<Node> parse_assignment() {
-        auto const& tok = m_toks[m_idx];
-        if (tok.m_type != Token::Type::Identifier)
-            throw std::runtime_error(
-                "Expected an identifier on the left-side of an "
-                "assignment.\n");
-        auto name = m_ctx.get_from_range(tok.m_range);
-        // we already know there is an equals sign...
-        m_idx += 2;
-        auto rhs = parse_expr();
+// the running state of an aggregate over rows of type T
+template <typename T>
+using AggregateOf =
+    std::conditional_t<std::is_same_v<T, Interval>, IntervalAggregate,
+                       Aggregate>;
 
-        return std::make_unique<AssignmentNode>(
-            AssignmentNode(name, std::move(rhs)));
+// the group a row goes to. an interval key has to be a single value, rows
+// that might fall in more than one group can't be counted in any
+template <typename T>
+double group_key(T const& key) {
+    if constexpr (std::is_same_v<T, Interval>) {
+        if (key.lo != key.hi and not key.is_nan())
+            throw std::runtime_error("The group key " +
+                                     Arithmetic<Interval>::format(key) +
+                                     " isn't a single value\n");
+        return key.lo;
+    } else {
+        return key;
     }
+}
 
-    std::unique_ptr<Node> parse_fact() {
-        auto const& tok = m_toks[m_idx];
+// bit pattern a group key is compared and hashed by. -0 and 0 are one
+// group, and so are all NaNs
+inline std::uint64_t key_bits(double key) {
+    if (key == 0)
+        key = 0;
+    if (key != key)
+        key = std::numeric_limits<double>::quiet_NaN();
 
-        m_idx += 1;
+    std::uint64_t bits;
+    std::memcpy(&bits, &key, sizeof(bits));
+    return bits;
+}
 
-        switch (tok.m_type) {
-            case Token::Type::Number: {
-                std::string str = m_ctx.get_from_range(tok.m_range);
-                try {
-                    return std::make_unique<NumberNode>(
-                        NumberNode(std::stod(str)));
-                } catch (std::exception const& e) {
-                    throw std::runtime_error("invalid number conversion error");
-                }
-            };
+inline std::uint64_t hash_bits(std::uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ull;
+    bits ^= bits >> 33;
+    return bits;
+}
 
-            case Token::Type::Identifier:
-                return std::make_unique<IdentNode>(
-                    IdentNode(m_ctx.get_from_range(tok.m_range)));
+// open addressing table from group key to the aggregates of that group.
+// slots carry the key bits next to the dense group index, so a probe stays
+// within a cache line or two, and the group states themselves are packed
+// back to back in insertion order
+template <typename State>
+class GroupTable {
+    static constexpr std::uint32_t kEmpty = ~std::uint32_t(0);
 
-            case Token::Type::Plus:
-            case Token::Type::Minus:
-            case Token::Type::Asterisk:
-            case Token::Type::Solidus:
-            case Token::Type::RightParanthesis:
-            case Token::Type::Equals:
-                throw std::runtime_error("Invalid token in parse stream\n");
+    struct Slot {
+        std::uint64_t key;
+        std::uint32_t group;
+    };
 
-            case Token::Type::LeftParanthesis:
-                auto ret_val = parse_expr();
-                if (m_toks[m_idx].m_type != Token::Type::RightParanthesis)
-                    throw std::runtime_error("Expected a left-paranthesis\n");
-                return ret_val;
+    std::vector<Slot> m_slots;
+    std::size_t m_mask;
+    unsigned m_width;
+    std::vector<double> m_keys;
+    std::vector<State> m_states;
+
+    void grow() {
+        std::vector<Slot> old(m_slots.size() * 2, Slot{0, kEmpty});
+        old.swap(m_slots);
+        m_mask = m_slots.size() - 1;
+
+        for (auto const& slot : old) {
+            if (slot.group == kEmpty)
+                continue;
+
+            std::size_t idx = hash_bits(slot.key) & m_mask;
+            while (m_slots[idx].group != kEmpty)
+                idx = (idx + 1) & m_mask;
+            m_slots[idx] = slot;
         }
     }
 
-    std::unique_ptr<Node> parse_term() {
-        auto left = parse_fact();
+   public:
+    // `width` aggregates are kept per group
+    explicit GroupTable(unsigned const width)
+        : m_slots(16, Slot{0, kEmpty}), m_mask(15), m_width(width) {}
 
-        for (;;) {
-            auto const& op = m_toks[m_idx];
+    std::size_t size() const noexcept { return m_keys.size(); }
+    double key(std::size_t const group) const noexcept {
+        return m_keys[group];
+    }
 
-            if (op.m_type != Token::Type::Asterisk and
-                op.m_type != Token::Type::Solidus)
+    State* states(std::size_t const group) noexcept {
+        return m_states.data() + group * m_width;
+    }
+    State const* states(std::size_t const group) const noexcept {
+        return m_states.data() + group * m_width;
+    }
+
+    // `hash` must be hash_bits(key_bits(key))
+    State* find_or_insert(double const key, std::uint64_t const hash) {
+        std::uint64_t const bits = key_bits(key);
+
+        for (std::size_t idx = hash & m_mask;; idx = (idx + 1) & m_mask) {
+            Slot& slot = m_slots[idx];
+            if (slot.group == kEmpty)
                 break;
+            if (slot.key == bits)
+                return states(slot.group);
+        }
 
-            m_idx += 1;
+        // keep the load factor at or below one half
+        if ((size() + 1) * 2 > m_slots.size())
+            grow();
 
-            auto right = parse_term();
+        std::size_t idx = hash & m_mask;
+        while (m_slots[idx].group != kEmpty)
+            idx = (idx + 1) & m_mask;
 
-            left = std::make_unique<BinaryNode>(
-                BinaryNode(op.m_type == Token::Type::Asterisk
-                               ? BinaryNode::Action::Multiply
-                               : BinaryNode::Action::Divide,
-                           std::move(left), std::move(right)));
+        m_slots[idx] = Slot{bits, std::uint32_t(size())};
+        m_keys.push_back(key);
+        m_states.resize(m_states.size() + m_width);
+        return states(size() - 1);
+    }
+
+    void merge(GroupTable const& other) {
+        for (std::size_t group = 0; group < other.size(); group++) {
+            double const key = other.key(group);
+            State* const into = find_or_insert(key, hash_bits(key_bits(key)));
+            for (unsigned i = 0; i < m_width; i++)
+                into[i].merge(other.states(group)[i]);
         }
+    }
+};
 
-        return left;
+// a worker's groups. starts out as one table, and once that outgrows the
+// cache the groups are radix partitioned over smaller tables by the top
+// bits of their hash. partitions with the same index can then be merged
+// across workers independently of each other
+template <typename State>
+class GroupAggregator {
+    static constexpr unsigned kPartitionBits = 6;
+    static constexpr std::size_t kPartitionThreshold = std::size_t(1) << 16;
+
+    unsigned m_width;
+    std::vector<GroupTable<State>> m_parts;
+
+   public:
+    static constexpr unsigned kPartitions = 1u << kPartitionBits;
+
+    explicit GroupAggregator(unsigned const width)
+        : m_width(width), m_parts(1, GroupTable<State>(width)) {}
+
+    bool partitioned() const noexcept { return m_parts.size() > 1; }
+    std::vector<GroupTable<State>>& parts() noexcept { return m_parts; }
+
+    void partition() {
+        if (partitioned())
+            return;
+
+        GroupTable<State> const whole = std::move(m_parts.front());
+        m_parts.assign(kPartitions, GroupTable<State>(m_width));
+        for (std::size_t group = 0; group < whole.size(); group++) {
+            double const key = whole.key(group);
+            State* const into = find_or_insert(key);
+            std::copy_n(whole.states(group), m_width, into);
+        }
     }
 
-    std::unique_ptr<Node> parse_expr() {
-        auto left = parse_term();
+    State* find_or_insert(double const key) {
+        std::uint64_t const hash = hash_bits(key_bits(key));
+        if (not partitioned()) {
+            State* const states = m_parts.front().find_or_insert(key, hash);
+            if (m_parts.front().size() <= kPartitionThreshold)
+                return states;
 
-        for (;;) {
-            auto const& op = m_toks[m_idx];
+            partition();
+        }
 
-            if (op.m_type != Token::Type::Plus and
-                op.m_type != Token::Type::Minus)
-                break;
+        return m_parts[hash >> (64 - kPartitionBits)].find_or_insert(key,
+                                                                     hash);
+    }
+};
 
-            m_idx += 1;
+// --agg: reduces the selected rows of every chunk into per-worker partial
+// aggregates, merged once all chunks are done. with --group-by each worker
+// keeps its partials in its own group tables instead
+template <typename T>
+int run_aggregates(Options const& options, VirtualMachine& vm) {
+    using State = AggregateOf<T>;
+    auto const source = open_source<T>(options);
+    auto const specs = parse_aggregates(options.aggs);
+    bool const grouped = not options.group_by.empty();
 
-            auto right = parse_term();
+    // count() has no expression, the others evaluate theirs into
+    // results[arg_of[i]]. the group key, if any, is evaluated last
+    std::vector<std::string> args;
+    std::vector<int> arg_of;
+    for (auto const& spec : specs) {
+        arg_of.push_back(spec.arg.empty() ? -1 : int(args.size()));
+        if (not spec.arg.empty())
+            args.push_back(spec.arg);
+    }
 
-            left = std::make_unique<BinaryNode>(BinaryNode(
-                op.m_type == Token::Type::Plus ? BinaryNode::Action::Add
-                                               : BinaryNode::Action::Subtract,
-                std::move(left), std::move(right)));
+    // one aggregate per argument expression plus one for the row count
+    unsigned const width = args.size() + 1;
+    if (grouped)
+        args.push_back(options.group_by);
+
+    std::vector<std::unique_ptr<ColumnProgram<T>>> programs;
+    for (unsigned i = 0; i < options.threads; i++)
+        programs.push_back(std::make_unique<ColumnProgram<T>>(
+            source->columns(), options.where, args, vm));
+
+    std::vector<std::vector<State>> partials(options.threads,
+                                             std::vector<State>(width));
+    std::vector<GroupAggregator<State>> groups(options.threads,
+                                               GroupAggregator<State>(width));
+
+    std::size_t const chunks = source->chunks();
+    for (std::size_t idx = 0; idx < std::min<std::size_t>(chunks,
+                                                          options.threads);
+         idx++)
+        source->prefetch(idx);
+
+    run_chunks(chunks, options.threads, [&](std::size_t idx, unsigned worker) {
+        ColumnProgram<T>& program = *programs[worker];
+        auto& partial = partials[worker];
+        auto& group = groups[worker];
+
+        std::vector<std::vector<T>> results(args.size(),
+                                            std::vector<T>(kBlockRows));
+        std::vector<T*> result_ptrs;
+        for (auto& result : results)
+            result_ptrs.push_back(result.data());
+
+        BlockScratch<T> scratch;
+        BlockFrame<T> frame{.columns = {}, .rows = 0, .scratch = scratch};
+
+        stream_chunk(*source, idx, options.threads, program, frame, [&] {
+            program.filter(frame);
+            if (frame.rows == 0)
+                return;
+
+            program.evaluate(frame, result_ptrs);
+
+            if (not grouped) {
+                for (unsigned i = 0; i + 1 < width; i++)
+                    partial[i].add(results[i].data(), frame.rows);
+                partial.back().count += frame.rows;
+                return;
+            }
+
+            T const* const keys = results.back().data();
+            for (std::size_t row = 0; row < frame.rows; row++) {
+                State* const states =
+                    group.find_or_insert(group_key(keys[row]));
+                for (unsigned i = 0; i + 1 < width; i++)
+                    states[i].add(results[i][row]);
+                states[width - 1].count += 1;
+            }
+        });
+    });
+
+    std::vector<std::string> labels;
+    for (auto const& spec : specs)
+        labels.push_back(spec.label);
+
+    std::string out;
+    for (auto const& label : output_columns<T>(labels)) {
+        if (not out.empty())
+            out += ',';
+        out += label;
+    }
+    if (grouped)
+        out = options.group_by + ',' + out;
+    out += '\n';
+
+    auto append_row = [&](State const* totals) {
+        for (unsigned i = 0; i < specs.size(); i++) {
+            if (i != 0)
+                out += ',';
+            auto const& total = totals[arg_of[i] < 0 ? width - 1 : arg_of[i]];
+            append_number(out, total.result(specs[i].function));
         }
+        out += '\n';
+    };
 
-        return left;
+    if (not grouped) {
+        std::vector<State> totals(width);
+        for (auto const& partial : partials) {
+            for (unsigned i = 0; i < width; i++)
+                totals[i].merge(partial[i]);
+        }
+
+        append_row(totals.data());
+        FileWriter(options.out_path).write(out);
+        return 0;
     }
 
-    std::unique_ptr<Node> parse_expr_or_statement() {
-        // quick hack to get assignment parsing working
-        if (m_idx < m_toks.size() - 1) {
-            if (m_toks[m_idx + 1].m_type == Token::Type::Equals)
-                return parse_assignment();
+    // merge everything into the first worker's tables. partitioned tables
+    // are merged one partition per task, the partitions don't overlap
+    auto& merged = groups.front();
+    bool const partitioned =
+        std::any_of(groups.begin(), groups.end(),
+                    [](auto const& group) { return group.partitioned(); });
+    if (partitioned) {
+        for (auto& group : groups)
+            group.partition();
+
+        run_chunks(GroupAggregator<State>::kPartitions, options.threads,
+                   [&](std::size_t part, unsigned) {
+                       for (std::size_t w = 1; w < groups.size(); w++)
+                           merged.parts()[part].merge(groups[w].parts()[part]);
+                   });
+    } else {
+        for (std::size_t w = 1; w < groups.size(); w++)
+            merged.parts().front().merge(groups[w].parts().front());
+    }
+
+    // groups come out ordered by key, NaN last
+    std::vector<std::pair<double, State const*>> rows;
+    for (auto const& table : merged.parts()) {
+        for (std::size_t group = 0; group < table.size(); group++)
+            rows.emplace_back(table.key(group), table.states(group));
+    }
+    std::sort(rows.begin(), rows.end(), [](auto const& a, auto const& b) {
+        return a.first < b.first or (a.first == a.first and b.first != b.first);
+    });
+
+    for (auto const& [key, states] : rows) {
+        append_number(out, key);
+        out += ',';
+        append_row(states);
+    }
+
+    FileWriter(options.out_path).write(out);
+    return 0;
+}
+
+// --csv / --columns without --expr or --agg: every input column becomes an
+// array variable in the repl
+void load_columns(Options const& options, VirtualMachine& vm) {
+    auto const source = open_source<double>(options);
+    auto const& columns = source->columns();
+
+    ColumnProgram<double> program(columns, "", {}, vm);
+    program.read_all();
+
+    std::vector<std::shared_ptr<Value::Array>> arrays;
+    for (unsigned c = 0; c < columns.size(); c++)
+        arrays.push_back(make_array(0));
+
+    run_ordered_chunks<std::vector<std::vector<double>>>(
+        source->chunks(), options.threads,
+        [&](std::size_t idx, unsigned) {
+            std::vector<std::vector<double>> chunk(columns.size());
+
+            BlockScratch<double> scratch;
+            BlockFrame<double> frame{
+                .columns = {}, .rows = 0, .scratch = scratch};
+            stream_chunk(*source, idx, options.threads, program, frame, [&] {
+                for (unsigned c = 0; c < columns.size(); c++)
+                    chunk[c].insert(chunk[c].end(), frame.columns[c],
+                                    frame.columns[c] + frame.rows);
+            });
+
+            return chunk;
+        },
+        [&](std::vector<std::vector<double>> const& chunk) {
+            for (unsigned c = 0; c < columns.size(); c++)
+                arrays[c]->insert(arrays[c]->end(), chunk[c].begin(),
+                                  chunk[c].end());
+        });
+
+    for (unsigned c = 0; c < columns.size(); c++)
+        vm.set(columns[c], std::move(arrays[c]));
+}
+
+// long arrays only show their ends
+std::string format_value(Value const& value) {
+    if (not value.is_array())
+        return std::to_string(value.number());
+
+    constexpr std::size_t kShown = 8;
+
+    // matrices print a row per line
+    if (value.is_matrix()) {
+        auto const& array = value.array();
+        bool const elide = value.rows() > 2 * kShown;
+        std::string out;
+        for (std::size_t i = 0; i < value.rows(); i++) {
+            if (elide and i == kShown) {
+                out += " ...,\n";
+                i = value.rows() - kShown;
+            }
+
+            auto row = std::make_shared<Value::Array>(
+                array.begin() + i * value.cols(),
+                array.begin() + (i + 1) * value.cols());
+            out += (i == 0 ? "[" : " ") + format_value(std::move(row));
+            out += i + 1 < value.rows() ? ",\n" : "]";
+        }
+        return out + " (" + std::to_string(value.rows()) + "x" +
+               std::to_string(value.cols()) + ")";
+    }
+
+    auto const& array = value.array();
+    bool const elide = array.size() > 2 * kShown;
+
+    std::string out = "[";
+    for (std::size_t i = 0; i < array.size(); i++) {
+        if (elide and i == kShown) {
+            out += "..., ";
+            i = array.size() - kShown;
         }
 
-        return parse_expr();
+        out += std::to_string(array[i]);
+        if (i + 1 < array.size())
+            out += ", ";
     }
+    out += ']';
 
-   public:
-    static std::unique_ptr<Node> parse(CompileContext const& ctx,
-                                       std::vector<Token> const& toks) {
-        return Parser(ctx, toks).parse_expr_or_statement();
+    if (elide)
+        out += " (" + std::to_string(array.size()) + " elements)";
+    return out;
+}
+
+// the same text as format_value, into `out` which keeps its storage between
+// calls. numbers, the common case, are printed without a temporary
+void format_value(Value const& value, std::string& out) {
+    out.clear();
+    if (value.is_array()) {
+        out += format_value(value);
+        return;
     }
-};
 
-int main() {
-    std::cout << "Type \"quit\" to leave.\n";
+    // what std::to_string prints. %f of the largest double is 316 chars
+    char buf[320];
+    out.append(buf, std::snprintf(buf, sizeof buf, "%f", value.number()));
+}
 
-    VirtualMachine vm;
+// the :mem report, and the summary of --mem at exit
+void report_memory(std::ostream& out) {
+    if (g_memory.tracking) {
+        out << "phase        allocs          bytes\n";
+        for (std::size_t i = 0; i < kPhases; i++) {
+            char line[64];
+            std::snprintf(line, sizeof line, "%-9s %9llu %14llu\n",
+                          kPhaseNames[i],
+                          (unsigned long long)g_memory.allocs[i].load(),
+                          (unsigned long long)g_memory.bytes[i].load());
+            out << line;
+        }
+        out << "live: " << g_memory.live << " bytes (peak " << g_memory.peak
+            << ")\n";
+    } else {
+        out << "allocation tracking is off, start with --mem\n";
+    }
+
+    auto const& arena = BlockArena::local();
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    out << "arena: " << arena.in_use() << " bytes in use, " << arena.cached()
+        << " cached\npeak rss: " << usage.ru_maxrss << " KiB" << std::endl;
+}
+
+// `:name` lines in the repl
+void run_command(std::string_view const command, VirtualMachine& vm) {
+    if (command == ":stats") {
+        std::cout << "isa: " << kIsaNames[int(g_isa)];
+        if (g_isa != g_detected_isa)
+            std::cout << " (cpu supports " << kIsaNames[int(g_detected_isa)]
+                      << ")";
+        std::cout << "\nthreads: " << vm.threads()
+                  << "\nvariables: " << vm.variable_count() << std::endl;
+        return;
+    }
+
+    if (command == ":mem") {
+        report_memory(std::cout);
+        return;
+    }
+
+    throw std::runtime_error("Unknown command " + std::string(command) +
+                             "\n");
+}
+
+// reads lines until EOF or "quit" and hands the non-blank ones to `line`.
+// errors are printed and the loop carries on
+template <typename Line>
+void repl(Line&& line) {
+    std::cout << "Type \"quit\" to leave.\n";
 
+    // one buffer for every line, getline keeps its capacity
+    std::string input;
     while (true) {
         std::cout << ">> ";
 
-        std::string input;
-        std::getline(std::cin, input);
-
-        if (input == "quit")
+        if (not std::getline(std::cin, input) or input == "quit")
             break;
 
+        if (input.find_first_not_of(' ') == std::string::npos)
+            continue;
+
         try {
+            line(input);
+        } catch (std::exception const& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }
+}
+
+// the repl on a BasicVirtualMachine<T>: scalars only, in the number type T
+template <typename T>
+void run_machine_repl() {
+    BasicVirtualMachine<T> machine;
+
+    repl([&](std::string const& input) {
+        TraceScope const trace("statement");
+        CompileContext ctx = {
+            .src = input,
+        };
+
+        Program program;
+        program.imaginary = std::is_same_v<T, Complex>;
+        auto const tree = Parser::parse(ctx, tokenize(input));
+        {
+            PhaseScope const phase(Phase::Bind);
+            tree->compile(program);
+        }
+
+        if (g_perf.enabled())
+            g_perf.count_statement();
+        PhaseScope const phase(Phase::Execute);
+        if (auto const value = machine.run(program))
+            std::cout << Arithmetic<T>::format(*value) << std::endl;
+    });
+}
+
+Mode const kModes[] = {
+    {"float", run_machine_repl<float>},
+    {"long-double", run_machine_repl<long double>},
+    {"int64", run_machine_repl<std::int64_t>},
+    {"rational", run_machine_repl<Rational>},
+    {"bigint", run_machine_repl<BigInt>},
+    {"bigfloat", run_machine_repl<BigFloat>},
+    {"interval", run_machine_repl<Interval>},
+    {"complex", run_machine_repl<Complex>},
+    {"decimal", run_machine_repl<Decimal>},
+};
+
+Options parse_options(int argc, char** argv) {
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string const arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::runtime_error("Missing value for " + arg + "\n");
+            return argv[++i];
+        };
+
+        if (arg == "--csv") {
+            options.csv_path = value();
+        } else if (arg == "--expr") {
+            options.exprs.push_back(value());
+        } else if (arg == "--where") {
+            options.where = value();
+        } else if (arg == "--agg") {
+            options.aggs = value();
+        } else if (arg == "--group-by") {
+            options.group_by = value();
+        } else if (arg == "--columns") {
+            options.manifest_path = value();
+        } else if (arg == "--out") {
+            options.out_path = value();
+        } else if (arg == "--out-dir") {
+            options.out_dir = value();
+        } else if (arg == "--threads") {
+            auto const str = value();
+            auto const [ptr, ec] = std::from_chars(
+                str.data(), str.data() + str.size(), options.threads);
+            if (ec != std::errc() or ptr != str.data() + str.size() or
+                options.threads == 0)
+                throw std::runtime_error("Invalid thread count\n");
+        } else if (arg == "--precision") {
+            auto const precision = value();
+            if (precision != "f32" and precision != "f64")
+                throw std::runtime_error("Precision is f32 or f64\n");
+            options.single = precision == "f32";
+        } else if (arg == "--mode") {
+            auto const name = value();
+            for (auto const& mode : kModes) {
+                if (name == mode.name)
+                    options.mode = &mode;
+            }
+            if (not options.mode and name != "double")
+                throw std::runtime_error("Unknown mode " + name + "\n");
+        } else if (arg == "--digits") {
+            auto const str = value();
+            auto const [ptr, ec] = std::from_chars(
+                str.data(), str.data() + str.size(), options.digits);
+            if (ec != std::errc() or ptr != str.data() + str.size() or
+                options.digits == 0 or options.digits > 1000000)
+                throw std::runtime_error("Invalid digit count\n");
+        } else if (arg == "--scale") {
+            auto const str = value();
+            unsigned scale = 0;
+            auto const [ptr, ec] =
+                std::from_chars(str.data(), str.data() + str.size(), scale);
+            if (ec != std::errc() or ptr != str.data() + str.size() or
+                scale > Decimal::kMaxScale)
+                throw std::runtime_error("Scale goes from 0 to 18\n");
+            options.scale = scale;
+        } else if (arg == "--rounding") {
+            auto const name = value();
+            for (unsigned i = 0; i < std::size(kRoundingNames); i++) {
+                if (name == kRoundingNames[i])
+                    options.rounding = Rounding(i);
+            }
+            if (not options.rounding)
+                throw std::runtime_error("Unknown rounding " + name + "\n");
+        } else if (arg == "--mem") {
+            options.mem = true;
+        } else if (arg == "--perf") {
+            options.perf = true;
+        } else if (arg == "--trace") {
+            options.trace_path = value();
+        } else if (arg == "--isa") {
+            auto const name = value();
+            auto const* const found =
+                std::find(std::begin(kIsaNames), std::end(kIsaNames), name);
+            if (found == std::end(kIsaNames))
+                throw std::runtime_error("Unknown isa " + name + "\n");
+            options.isa = Isa(found - std::begin(kIsaNames));
+            if (options.isa > g_detected_isa)
+                throw std::runtime_error("This cpu doesn't support " + name +
+                                         "\n");
+        } else {
+            throw std::runtime_error("Unknown option " + arg + "\n");
+        }
+    }
+
+    bool const has_input =
+        not options.csv_path.empty() or not options.manifest_path.empty();
+    if (not options.csv_path.empty() and not options.manifest_path.empty())
+        throw std::runtime_error("--csv and --columns are exclusive\n");
+    bool const has_work = not options.exprs.empty() or not options.aggs.empty();
+    if (has_work and not has_input)
+        throw std::runtime_error(
+            "--expr/--agg need an input (--csv or --columns)\n");
+    if (not options.exprs.empty() and not options.aggs.empty())
+        throw std::runtime_error("--expr and --agg are exclusive\n");
+    if (not options.where.empty() and not has_work)
+        throw std::runtime_error("--where needs --expr or --agg\n");
+    if (not options.out_path.empty() and not options.out_dir.empty())
+        throw std::runtime_error("--out and --out-dir are exclusive\n");
+    if (not options.group_by.empty() and options.aggs.empty())
+        throw std::runtime_error("--group-by needs --agg\n");
+    if (not options.aggs.empty() and not options.out_dir.empty())
+        throw std::runtime_error("--agg writes csv, use --out\n");
+    if (options.single and not has_work)
+        throw std::runtime_error("--precision needs --expr or --agg\n");
+    options.interval = has_work and options.mode and
+                       options.mode->name == std::string_view("interval");
+    if (options.interval and options.single)
+        throw std::runtime_error("--precision and --mode are exclusive\n");
+    if (options.mode and has_input and not options.interval)
+        throw std::runtime_error(
+            "--mode only applies to the repl, and interval to --expr/--agg\n");
+    if (options.digits and
+        not(options.mode and options.mode->name == std::string_view("bigfloat")))
+        throw std::runtime_error("--digits needs --mode bigfloat\n");
+    if ((options.scale or options.rounding) and
+        not(options.mode and options.mode->name == std::string_view("decimal")))
+        throw std::runtime_error("--scale/--rounding need --mode decimal\n");
+
+    return options;
+}
+
+// distinct repl lines whose trees are kept for when they come again
+constexpr std::size_t kCachedTrees = 1024;
+
+// bench/ includes this file for its internals and brings its own main
+#ifndef CALC_NO_MAIN
+int main(int argc, char** argv) {
+    Options options;
+    VirtualMachine vm;
+
+    // --mem, --perf and --trace report at the end, however the run ends
+    struct Summary {
+        Options const& options;
+        ~Summary() {
+            if (not options.trace_path.empty())
+                g_trace.write();
+            if (options.perf)
+                g_perf.report(std::cerr);
+            if (options.mem)
+                report_memory(std::cerr);
+        }
+    } const summary{options};
+
+    try {
+        options = parse_options(argc, argv);
+        vm.set_threads(options.threads);
+        g_isa = options.isa;
+        g_memory.tracking = options.mem;
+        if (options.perf)
+            g_perf.open();
+        if (not options.trace_path.empty())
+            g_trace.start(options.trace_path);
+
+        if (not options.exprs.empty()) {
+            PhaseScope const phase(Phase::Execute);
+            if (options.interval)
+                return run_columns<Interval>(options, vm);
+            return options.single ? run_columns<float>(options, vm)
+                                  : run_columns<double>(options, vm);
+        }
+        if (not options.aggs.empty()) {
+            PhaseScope const phase(Phase::Execute);
+            if (options.interval)
+                return run_aggregates<Interval>(options, vm);
+            return options.single ? run_aggregates<float>(options, vm)
+                                  : run_aggregates<double>(options, vm);
+        }
+        if (not options.csv_path.empty() or not options.manifest_path.empty())
+            load_columns(options, vm);
+        if (options.digits)
+            BigFloat::set_digits(options.digits);
+        if (options.scale)
+            Decimal::set_scale(*options.scale);
+        if (options.rounding)
+            Decimal::s_rounding = *options.rounding;
+        if (options.mode) {
+            options.mode->run();
+            return 0;
+        }
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    // kept across lines, so a warmed up loop doesn't allocate: the tokens,
+    // the output text, and the trees of lines seen before. nodes come from
+    // the BlockArena
+    std::vector<Token> toks;
+    std::string output;
+    FlatMap<std::unique_ptr<Node>> trees;
+
+    repl([&](std::string const& input) {
+        TraceScope const trace("statement");
+        vm.clear_stack();
+        if (input.front() == ':') {
+            run_command(input, vm);
+            return;
+        }
+
+        std::unique_ptr<Node> parse;
+        auto* tree = trees.find(input);
+        if (not tree) {
             CompileContext ctx = {
                 .src = input,
             };
 
-            auto const toks = tokenize(input);
-            // for (auto const& tok : toks) {
-            //     std::cout << tok.debug_print() << std::endl;
-            // }
-            auto parse = Parser::parse(ctx, toks);
+            tokenize(input, toks);
+            parse = Parser::parse(ctx, toks);
+            tree = &parse;
+            if (trees.size() < kCachedTrees)
+                tree = &(trees[input] = std::move(parse));
+        }
 
-            parse->execute(vm);
+        if (g_perf.enabled())
+            g_perf.count_statement();
+        {
+            PhaseScope const phase(Phase::Execute);
+            (*tree)->execute(vm);
+        }
 
-            if (vm.stack_size() > 0)
-                std::cout << std::to_string(vm.pop()) << std::endl;
-        } catch (std::exception const& e) {
-            std::cout << e.what() << std::endl;
+        if (vm.stack_size() > 0) {
+            format_value(vm.pop_value(), output);
+            std::cout << output << std::endl;
         }
-    }
+    });
 }
+#endif
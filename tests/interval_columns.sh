@@ -0,0 +1,42 @@
+#!/bin/sh
+# --mode interval in the column engine: every result is a _lo and a _hi
+# column around the exact value, aggregates enclose theirs too, and a row
+# whose condition may go either way is an error
+set -eu
+
+calc=${1:-./calc}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf 'x,k\n0.1,1\n-0.25,2\n7,1\n,2\n' >"$dir/in.csv"
+
+cat >"$dir/expected" <<'OUT'
+s_lo,s_hi,c_lo,c_hi
+0.29999999999999993,0.30000000000000004,0,1
+-0.75,-0.75,0,0
+21,21,0,0
+nan,nan,0,0
+h_lo,h_hi
+3.5,3.5
+k,sum(x)_lo,sum(x)_hi,count()_lo,count()_hi,min(x)_lo,min(x)_hi
+1,7.1,7.1000000000000005,2,2,0.09999999999999999,0.1
+2,nan,nan,2,2,-0.25,-0.25
+The condition [0, 1] may or may not be 0
+
+OUT
+
+{
+    "$calc" --csv "$dir/in.csv" --mode interval --expr 's = x * 3' \
+        --expr 'c = s == 0.3'
+    "$calc" --csv "$dir/in.csv" --mode interval --expr 'h = x / 2' \
+        --where 'k == 1 and x > 1'
+    "$calc" --csv "$dir/in.csv" --mode interval \
+        --agg 'sum(x), count(), min(x)' --group-by k
+    if "$calc" --csv "$dir/in.csv" --mode interval --expr 'x' \
+        --where 'x * 3 == 0.3' >/dev/null 2>"$dir/error"; then
+        echo "undecided --where didn't fail"
+    fi
+    cat "$dir/error"
+} | diff "$dir/expected" -
+echo "interval columns: ok"
@@ -0,0 +1,47 @@
+#!/bin/sh
+# a NaN stays in the carry of cummax and scan(v, min|max): in an odd and an
+# even position, in short arrays and in ones long enough to be scanned in
+# parallel blocks. the long ones are checked by their NaN count and the sum
+# of what comes before the NaN
+set -eu
+
+calc=${1:-./calc}
+
+expected=$(mktemp)
+trap 'rm -f "$expected"' EXIT
+
+cat >"$expected" <<'OUT'
+Type "quit" to leave.
+>> [5.000000, 5.000000, -nan, -nan, -nan, -nan]
+>> [5.000000, 5.000000, 5.000000, -nan, -nan, -nan]
+>> [5.000000, 1.000000, -nan, -nan, -nan, -nan]
+>> [5.000000, 1.000000, 1.000000, -nan, -nan, -nan]
+>> [5.000000, 5.000000, -nan, -nan, -nan, -nan]
+>> >> >> >> [99999.000000, 5000050000.000000]
+>> >> [100000.000000, 4999950000.000000]
+>> >> [99999.000000, 15000150000.000000]
+>> >> [100000.000000, 15000050000.000000]
+>> 
+OUT
+
+{
+    "$calc" --threads 4 <<'IN'
+cummax([5, 1, 0/0, 2, 1, 0])
+cummax([5, 1, 2, 0/0, 1, 0])
+scan([5, 1, 0/0, 2, 1, 0], min)
+scan([5, 1, 2, 0/0, 1, 0], min)
+scan([5, 1, 0/0, 2, 1, 0], max)
+v = range(200000)
+ones = v * 0 + 1
+r = cummax(v == 100001 ? 0/0 : v)
+[dot(r != r, ones), dot(r == r ? r : 0, ones)]
+r = cummax(v == 100000 ? 0/0 : v)
+[dot(r != r, ones), dot(r == r ? r : 0, ones)]
+r = scan(v == 100001 ? 0/0 : 200000 - v, min)
+[dot(r != r, ones), dot(r == r ? r : 0, ones)]
+r = scan(v == 100000 ? 0/0 : 200000 - v, min)
+[dot(r != r, ones), dot(r == r ? r : 0, ones)]
+IN
+    echo
+} | diff "$expected" -
+echo "scan nan: ok"
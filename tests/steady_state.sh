@@ -0,0 +1,27 @@
+#!/bin/sh
+# a warmed up repl loop must not allocate: runs the same statements n and
+# 10n times under --mem and expects the same allocation count from both
+set -eu
+
+calc=${1:-./calc}
+
+allocations() {
+    awk -v n="$1" 'BEGIN {
+        print "x = 1"
+        print "y = 2"
+        for (i = 0; i < n; i++) {
+            print "x + 1"
+            print "x = x * 0.999 + y"
+        }
+    }' | "$calc" --mem 2>&1 >/dev/null |
+        awk 'NR > 1 && NF == 3 { total += $2 } END { print total }'
+}
+
+few=$(allocations 100)
+many=$(allocations 1000)
+
+if [ "$few" != "$many" ]; then
+    echo "steady state: $few allocations for 100 rounds, $many for 1000"
+    exit 1
+fi
+echo "steady state: $few allocations either way"